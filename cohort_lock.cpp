@@ -0,0 +1,329 @@
+#include <chrono>
+#include <dirent.h>
+#include <new>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "cohort_lock.hpp"
+
+using namespace std::chrono;
+
+const uint32_t CohortSharedLock::DEFAULT_LOCAL_HANDOFFS = 64;
+const int32_t CohortSharedLock::NO_NODE = -1;
+thread_local std::vector<CohortSharedLock::CohortHold> CohortSharedLock::_holds;
+
+CohortSharedLock::CohortSharedLock(PreferencePolicy policy): CohortSharedLock(policy, CohortSharedLock::DEFAULT_LOCAL_HANDOFFS){};
+
+CohortSharedLock::CohortSharedLock(PreferencePolicy policy, uint32_t max_local_handoffs): CohortSharedLock(policy, max_local_handoffs, 0, CohortSharedLock::f_node()){};
+
+CohortSharedLock::CohortSharedLock(PreferencePolicy policy, uint32_t max_local_handoffs, uint32_t num_nodes, f_node node_resolver): _global_handoffs(0), _global_owner(CohortSharedLock::NO_NODE), _local_handoffs(0), _max_local_handoffs(max_local_handoffs), _node_resolver(node_resolver), _policy(policy), _waiting_readers(0), _waiting_writers(0), _writers(0){
+	if(policy != PreferencePolicy::READER and policy != PreferencePolicy::WRITER and policy != PreferencePolicy::NONE) throw std::runtime_error("Policy not supported by cohort lock");
+	if(num_nodes == 0) num_nodes = CohortSharedLock::detectNodes();
+	for(uint32_t index = 0; index < num_nodes; index++) {
+		//Plain new does not honour the cache line alignment before C++17
+		void* memory = NULL;
+		if(posix_memalign(&memory, alignof(CohortSharedLock::Node), sizeof(CohortSharedLock::Node)) != 0) throw std::bad_alloc();
+		CohortSharedLock::Node* node = new (memory) CohortSharedLock::Node();
+		node->readers = 0;
+		node->waiting_readers = 0;
+		node->waiting_writers = 0;
+		node->writer_active = false;
+		node->owns_global = false;
+		node->run_handoffs = 0;
+		_nodes.push_back(node);
+	}
+};
+
+CohortSharedLock::~CohortSharedLock(){
+	for(auto node: _nodes) {
+		node->~Node();
+		free(node);
+	}
+};
+
+/*Count of /sys/devices/system/node/nodeN, single node when unavailable*/
+uint32_t CohortSharedLock::detectNodes(){
+	uint32_t nodes = 0;
+	DIR* directory = opendir("/sys/devices/system/node");
+	if(directory == NULL) return 1;
+	struct dirent* entry;
+	while((entry = readdir(directory)) != NULL) {
+		if(strncmp(entry->d_name, "node", 4) == 0 and entry->d_name[4] >= '0' and entry->d_name[4] <= '9') nodes++;
+	}
+	closedir(directory);
+	return (nodes == 0) ? 1 : nodes;
+};
+
+uint32_t CohortSharedLock::currentNode(){
+#if defined(__linux__) && defined(SYS_getcpu)
+	unsigned int cpu = 0;
+	unsigned int node = 0;
+	if(syscall(SYS_getcpu, &cpu, &node, NULL) == 0) return node;
+#endif
+	return 0;
+};
+
+uint32_t CohortSharedLock::_node(){
+	uint32_t node = _node_resolver ? _node_resolver() : CohortSharedLock::currentNode();
+	return node % _nodes.size();
+};
+
+/*Readers stay out while a cohort owns the global lock, or WRITER policy has writers waiting*/
+bool CohortSharedLock::_readBlocked() const {
+	if(_global_owner.load() != CohortSharedLock::NO_NODE) return true;
+	return (_policy == PreferencePolicy::WRITER and _waiting_writers.load() > 0);
+};
+
+bool CohortSharedLock::_readersDrained() const {
+	for(auto node: _nodes) {
+		if(node->readers.load() > 0) return false;
+	}
+	return true;
+};
+
+//Writers waiting for the global lock or for readers to drain
+void CohortSharedLock::_notifyGlobal(){
+	std::unique_lock<std::mutex> gl(_global);
+	_global_cv.notify_all();
+};
+
+//Waiting readers sleep on their own node, must not be called with a node lock held
+void CohortSharedLock::_notifyNodes(){
+	for(auto node: _nodes) {
+		std::unique_lock<std::mutex> nl(node->lock);
+		if(node->waiting_readers > 0) node->cv.notify_all();
+	}
+};
+
+void CohortSharedLock::_enterHold(uint32_t node, bool write){
+	_holds.push_back({this, node, write});
+};
+
+uint32_t CohortSharedLock::_leaveHold(bool write){
+	for(auto hold = _holds.begin(); hold != _holds.end(); hold++) {
+		if(hold->lock != this or hold->write != write) continue;
+		uint32_t node = hold->node;
+		_holds.erase(hold);
+		return node;
+	}
+	throw std::runtime_error("Thread does not hold the lock");
+};
+
+/*
+Readers announce themselves in their node counter, then check the global
+owner. A writer sets the owner first and then waits for every counter to
+drop to zero, so either the reader sees the owner and backs off or the
+writer sees the reader and waits for it.
+*/
+bool CohortSharedLock::_waitRead(uint32_t node, bool timed, steady_clock::time_point deadline){
+	CohortSharedLock::Node* own = _nodes[node];
+	std::unique_lock<std::mutex> nl(own->lock);
+	bool waiting = false;
+	bool ret = true;
+	while(true) {
+		own->readers++;
+		if(!_readBlocked()) break;
+		//Back off, the owner may be waiting for this node to drain
+		if(--own->readers == 0 and _global_owner.load() != CohortSharedLock::NO_NODE) _notifyGlobal();
+		if(!waiting) {
+			waiting = true;
+			own->waiting_readers++;
+			_waiting_readers++;
+		}
+		if(!timed) own->cv.wait(nl, [this] {return !this->_readBlocked();});
+		else if(!own->cv.wait_until(nl, deadline, [this] {return !this->_readBlocked();})) {
+			ret = false;
+			break;
+		}
+	}
+	if(waiting) {
+		own->waiting_readers--;
+		//READER policy writers wait for waiting readers to go first
+		if(--_waiting_readers == 0 and _policy == PreferencePolicy::READER) _notifyGlobal();
+	}
+	if(ret) _enterHold(node, false);
+	return ret;
+};
+
+/*
+Local stage: one writer per node, a writer finding the global lock handed
+over by the previous writer of its node is done. Otherwise the cohort
+takes the global lock.
+*/
+bool CohortSharedLock::_waitWrite(uint32_t node, bool timed, steady_clock::time_point deadline){
+	CohortSharedLock::Node* own = _nodes[node];
+	std::unique_lock<std::mutex> nl(own->lock);
+	own->waiting_writers++;
+	_waiting_writers++;
+	bool local = true;
+	if(!timed) own->cv.wait(nl, [own] {return !own->writer_active;});
+	else local = own->cv.wait_until(nl, deadline, [own] {return !own->writer_active;});
+	own->waiting_writers--;
+	if(!local) {
+		bool last = (--_waiting_writers == 0);
+		nl.unlock();
+		//WRITER policy readers may have been waiting on us
+		if(last and _policy == PreferencePolicy::WRITER) _notifyNodes();
+		return false;
+	}
+	own->writer_active = true;
+	if(own->owns_global) {
+		//Readers are still drained, nobody released the global lock since
+		_waiting_writers--;
+		_writers++;
+		_enterHold(node, true);
+		return true;
+	}
+	nl.unlock();
+	bool ret = _acquireGlobal(node, timed, deadline);
+	nl.lock();
+	if(!ret) {
+		own->writer_active = false;
+		if(own->waiting_writers > 0) own->cv.notify_all();
+		return false;
+	}
+	own->owns_global = true;
+	own->run_handoffs = 0;
+	_writers++;
+	_enterHold(node, true);
+	return true;
+};
+
+bool CohortSharedLock::_acquireGlobal(uint32_t node, bool timed, steady_clock::time_point deadline){
+	std::unique_lock<std::mutex> gl(_global);
+	auto available = [this] {
+		if(this->_global_owner.load() != CohortSharedLock::NO_NODE) return false;
+		return !(this->_policy == PreferencePolicy::READER and this->_waiting_readers.load() > 0);
+	};
+	auto drained = [this] {return this->_readersDrained();};
+	bool ret = true;
+	if(!timed) _global_cv.wait(gl, available);
+	else ret = _global_cv.wait_until(gl, deadline, available);
+	if(ret) {
+		_global_owner = node;
+		//Readers already in leave, new ones back off
+		if(!timed) _global_cv.wait(gl, drained);
+		else if(!_global_cv.wait_until(gl, deadline, drained)) {
+			_global_owner = CohortSharedLock::NO_NODE;
+			_global_cv.notify_all();
+			ret = false;
+		}
+	}
+	_waiting_writers--;
+	gl.unlock();
+	//Readers held back by us or by our ownership
+	if(!ret) _notifyNodes();
+	return ret;
+};
+
+void CohortSharedLock::_releaseGlobal(){
+	{
+		std::unique_lock<std::mutex> gl(_global);
+		_global_owner = CohortSharedLock::NO_NODE;
+		_global_handoffs++;
+		_global_cv.notify_all();
+	}
+	_notifyNodes();
+};
+
+void CohortSharedLock::exclusiveLock(){
+	this->wSharedLock();
+};
+
+bool CohortSharedLock::tryExclusiveLock(){
+	return this->wTrySharedLock();
+};
+
+bool CohortSharedLock::tryExclusiveLock(uint16_t timeout){
+	return this->wTrySharedLock(timeout);
+};
+
+void CohortSharedLock::exclusiveUnlock(){
+	this->wSharedUnlock();
+};
+
+void CohortSharedLock::rSharedLock(){
+	_waitRead(_node(), false, steady_clock::time_point::max());
+};
+
+bool CohortSharedLock::rTrySharedLock(){
+	return this->rTrySharedLock(0);
+};
+
+bool CohortSharedLock::rTrySharedLock(uint16_t timeout){
+	return _waitRead(_node(), true, steady_clock::now() + milliseconds(timeout));
+};
+
+void CohortSharedLock::rSharedUnlock(){
+	CohortSharedLock::Node* own = _nodes[_leaveHold(false)];
+	//Last reader of the node out, the owner may be waiting for the drain
+	if(--own->readers == 0 and _global_owner.load() != CohortSharedLock::NO_NODE) _notifyGlobal();
+};
+
+void CohortSharedLock::wSharedLock(){
+	_waitWrite(_node(), false, steady_clock::time_point::max());
+};
+
+bool CohortSharedLock::wTrySharedLock(){
+	return this->wTrySharedLock(0);
+};
+
+bool CohortSharedLock::wTrySharedLock(uint16_t timeout){
+	return _waitWrite(_node(), true, steady_clock::now() + milliseconds(timeout));
+};
+
+/*
+Hand the global lock to the next writer of the same node while the local
+run is below _max_local_handoffs (and READER policy has no readers
+waiting), otherwise release it to every node.
+*/
+void CohortSharedLock::wSharedUnlock(){
+	CohortSharedLock::Node* own = _nodes[_leaveHold(true)];
+	std::unique_lock<std::mutex> nl(own->lock);
+	_writers--;
+	own->writer_active = false;
+	bool readers_first = (_policy == PreferencePolicy::READER and _waiting_readers.load() > 0);
+	if(own->waiting_writers > 0 and own->run_handoffs < _max_local_handoffs and !readers_first) {
+		own->run_handoffs++;
+		_local_handoffs++;
+		own->cv.notify_all();
+		return;
+	}
+	own->owns_global = false;
+	own->run_handoffs = 0;
+	//Next writer of our node competes for the global lock like the others
+	if(own->waiting_writers > 0) own->cv.notify_all();
+	nl.unlock();
+	_releaseGlobal();
+};
+
+int32_t CohortSharedLock::getNumberWriters() const {
+	return _writers;
+};
+
+int32_t CohortSharedLock::getNumberReaders() const {
+	int32_t readers = 0;
+	for(auto node: _nodes) readers += node->readers.load();
+	return readers;
+};
+
+int32_t CohortSharedLock::getNumberReaders(uint32_t node) const {
+	return _nodes[node % _nodes.size()]->readers;
+};
+
+uint32_t CohortSharedLock::getNumberNodes() const {
+	return _nodes.size();
+};
+
+uint64_t CohortSharedLock::getLocalHandoffs() const {
+	return _local_handoffs;
+};
+
+uint64_t CohortSharedLock::getGlobalHandoffs() const {
+	return _global_handoffs;
+};
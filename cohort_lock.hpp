@@ -0,0 +1,110 @@
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include "shared_lock.hpp"
+
+#pragma once
+
+/*
+NUMA aware cohort variant of SharedLock (a C-RW style cohort lock).
+Every node has its own mutex, condition variable and reader counter on its
+own cache line. Readers only touch their node, they announce themselves in
+the node counter and get in while no cohort owns the global write lock.
+Writers first win the local lock of their node, then the node cohort takes
+the global lock and waits for the readers of every node to drain. A
+releasing writer passes the global lock to the next writer of its node, up
+to max_local_handoffs times in a row, before releasing it to every node.
+Only READER, WRITER and NONE policies. Writers are mutually exclusive here,
+so exclusiveLock is the same as write access.
+*/
+class CohortSharedLock {
+	public:
+	typedef std::function<uint32_t()> f_node;
+	CohortSharedLock(PreferencePolicy policy);
+	CohortSharedLock(PreferencePolicy policy, uint32_t max_local_handoffs);
+	//num_nodes 0 detects them, node_resolver gives the node of the calling thread
+	CohortSharedLock(PreferencePolicy policy, uint32_t max_local_handoffs, uint32_t num_nodes, f_node node_resolver);
+	~CohortSharedLock();
+
+	//exclusive Access
+	void exclusiveLock();
+	bool tryExclusiveLock();
+	bool tryExclusiveLock(uint16_t timeout);
+	void exclusiveUnlock();
+
+	//read Access
+	void rSharedLock();
+	bool rTrySharedLock();
+	bool rTrySharedLock(uint16_t timeout);
+	void rSharedUnlock();
+
+	//write Access
+	void wSharedLock();
+	bool wTrySharedLock();
+	bool wTrySharedLock(uint16_t timeout);
+	void wSharedUnlock();
+
+	int32_t getNumberWriters() const;
+	//Also counts, for an instant, readers backing off from a writer
+	int32_t getNumberReaders() const;
+	int32_t getNumberReaders(uint32_t node) const;
+	uint32_t getNumberNodes() const;
+	uint64_t getLocalHandoffs() const;
+	uint64_t getGlobalHandoffs() const;
+
+	static uint32_t detectNodes();
+	static uint32_t currentNode();
+	static const uint32_t DEFAULT_LOCAL_HANDOFFS;
+	static const int32_t NO_NODE;
+	private:
+	//One per node, on its own cache line
+	struct alignas(64) Node {
+		std::mutex lock;
+		std::condition_variable cv;
+		std::atomic<int32_t> readers;
+		//Under lock
+		int32_t waiting_readers;
+		int32_t waiting_writers;
+		bool writer_active;
+		bool owns_global;
+		uint32_t run_handoffs;
+	};
+
+	//Node the calling thread took access on, released on the same one
+	struct CohortHold {
+		const CohortSharedLock* lock;
+		uint32_t node;
+		bool write;
+	};
+	static thread_local std::vector<CohortSharedLock::CohortHold> _holds;
+
+	uint32_t _node();
+	bool _readBlocked() const;
+	bool _readersDrained() const;
+	bool _waitRead(uint32_t node, bool timed, std::chrono::steady_clock::time_point deadline);
+	bool _waitWrite(uint32_t node, bool timed, std::chrono::steady_clock::time_point deadline);
+	bool _acquireGlobal(uint32_t node, bool timed, std::chrono::steady_clock::time_point deadline);
+	void _releaseGlobal();
+	void _leaveLocal(CohortSharedLock::Node* own, std::unique_lock<std::mutex>& nl);
+	void _notifyGlobal();
+	void _notifyNodes();
+	void _enterHold(uint32_t node, bool write);
+	uint32_t _leaveHold(bool write);
+	std::mutex _global;
+	std::condition_variable _global_cv;
+	std::atomic<uint64_t> _global_handoffs;
+	std::atomic<int32_t> _global_owner;
+	std::atomic<uint64_t> _local_handoffs;
+	uint32_t _max_local_handoffs;
+	f_node _node_resolver;
+	std::vector<CohortSharedLock::Node*> _nodes;
+	PreferencePolicy _policy;
+	std::atomic<int32_t> _waiting_readers;
+	std::atomic<int32_t> _waiting_writers;
+	std::atomic<int32_t> _writers;
+};
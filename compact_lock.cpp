@@ -0,0 +1,190 @@
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+
+#include "compact_lock.hpp"
+
+using namespace std::chrono;
+
+static_assert(sizeof(CompactSharedLock) == 8, "CompactSharedLock must stay one word");
+
+static const uint64_t READER_ONE = 1ull;
+static const uint64_t READER_MASK = 0xFFFFull;
+static const uint64_t WRITER_ONE = 1ull << 16;
+static const uint64_t WRITER_MASK = 0xFFFFull << 16;
+static const uint64_t WAITING_READER_ONE = 1ull << 32;
+static const uint64_t WAITING_READER_MASK = 0x3FFFull << 32;
+static const uint64_t WAITING_EXCLUSIVE_ONE = 1ull << 46;
+static const uint64_t WAITING_EXCLUSIVE_MASK = 0x3FFull << 46;
+static const uint64_t EXCLUSIVE = 1ull << 56;
+static const uint64_t PARKED = 1ull << 57;
+static const uint32_t POLICY_SHIFT = 58;
+static const uint64_t POLICY_MASK = 0x3ull << POLICY_SHIFT;
+static const uint64_t POLICY_NONE = 0ull << POLICY_SHIFT;
+static const uint64_t POLICY_READER = 1ull << POLICY_SHIFT;
+static const uint64_t POLICY_WRITER = 2ull << POLICY_SHIFT;
+
+/*
+Parking lot shared by every CompactSharedLock, waiters of a lock sleep on
+the bucket its address hashes to.
+*/
+struct alignas(64) ParkingBucket {
+	std::mutex lock;
+	std::condition_variable cv;
+};
+
+static const uint32_t PARKING_BUCKETS = 256;
+static ParkingBucket parking_lot[PARKING_BUCKETS];
+
+static ParkingBucket& parking_bucket(const void* address) {
+	uint64_t key = reinterpret_cast<uintptr_t>(address) >> 3;
+	return parking_lot[(key * 0x9E3779B97F4A7C15ull) >> 56];
+};
+
+CompactSharedLock::CompactSharedLock(PreferencePolicy policy){
+	switch(policy) {
+		case PreferencePolicy::NONE: _state = POLICY_NONE; break;
+		case PreferencePolicy::READER: _state = POLICY_READER; break;
+		case PreferencePolicy::WRITER: _state = POLICY_WRITER; break;
+		default: throw std::runtime_error("Policy not supported by compact lock");
+	}
+};
+
+/*Same rules as SharedLock read policies*/
+bool CompactSharedLock::_readAdmissible(uint64_t state){
+	if((state & EXCLUSIVE) or (state & WAITING_EXCLUSIVE_MASK)) return false;
+	switch(state & POLICY_MASK) {
+		case POLICY_NONE: return (state & WRITER_MASK) == 0;
+		case POLICY_WRITER: return !((state & READER_MASK) and (state & WRITER_MASK));
+		default: return true;
+	}
+};
+
+/*Same rules as SharedLock write policies*/
+bool CompactSharedLock::_writeAdmissible(uint64_t state){
+	if((state & EXCLUSIVE) or (state & WAITING_EXCLUSIVE_MASK)) return false;
+	switch(state & POLICY_MASK) {
+		case POLICY_NONE: return (state & (WRITER_MASK | READER_MASK)) == 0;
+		case POLICY_READER: return (state & (READER_MASK | WAITING_READER_MASK)) == 0;
+		default: return true;
+	}
+};
+
+bool CompactSharedLock::_exclusiveAdmissible(uint64_t state){
+	return !(state & EXCLUSIVE) and (state & (WRITER_MASK | READER_MASK)) == 0;
+};
+
+/*
+CAS loop: take access when admissible, otherwise announce ourselves in the
+waiting field (if any) and park until the state changes.
+*/
+bool CompactSharedLock::_acquire(f_admissible admissible, uint64_t acquired, uint64_t waiting, bool timed, steady_clock::time_point deadline){
+	uint64_t state = _state.load(std::memory_order_relaxed);
+	bool announced = false;
+	for(;;) {
+		//Our own waiting announcement must not block us
+		uint64_t own_state = announced ? state - waiting : state;
+		if(admissible(own_state)) {
+			if(_state.compare_exchange_weak(state, own_state + acquired, std::memory_order_acquire, std::memory_order_relaxed)) return true;
+			continue;
+		}
+		if(timed and steady_clock::now() >= deadline) break;
+		if(!announced and waiting != 0) {
+			if(_state.compare_exchange_weak(state, state + waiting, std::memory_order_relaxed)) {
+				announced = true;
+				state += waiting;
+			}
+			continue;
+		}
+		_park(state, timed, deadline);
+		state = _state.load(std::memory_order_relaxed);
+	}
+	if(announced) this->_release(waiting);
+	return false;
+};
+
+void CompactSharedLock::_release(uint64_t released){
+	uint64_t previous = _state.fetch_sub(released, std::memory_order_release);
+	if(previous & PARKED) this->_unpark();
+};
+
+/*Sleeps unless the state moved away from expected, the bucket lock closes the lost wakeup window*/
+bool CompactSharedLock::_park(uint64_t expected, bool timed, steady_clock::time_point deadline){
+	ParkingBucket& bucket = parking_bucket(this);
+	std::unique_lock<std::mutex> lk(bucket.lock);
+	if(!(expected & PARKED)) {
+		if(!_state.compare_exchange_strong(expected, expected | PARKED, std::memory_order_relaxed)) return false;
+	}
+	else if(_state.load(std::memory_order_relaxed) != expected) return false;
+	if(timed) return bucket.cv.wait_until(lk, deadline) == std::cv_status::no_timeout;
+	bucket.cv.wait(lk);
+	return true;
+};
+
+void CompactSharedLock::_unpark(){
+	_state.fetch_and(~PARKED, std::memory_order_relaxed);
+	ParkingBucket& bucket = parking_bucket(this);
+	std::unique_lock<std::mutex> lk(bucket.lock);
+	bucket.cv.notify_all();
+};
+
+void CompactSharedLock::exclusiveLock(){
+	_acquire(&CompactSharedLock::_exclusiveAdmissible, EXCLUSIVE, WAITING_EXCLUSIVE_ONE, false, steady_clock::time_point::max());
+};
+
+bool CompactSharedLock::tryExclusiveLock(){
+	return this->tryExclusiveLock(0);
+};
+
+bool CompactSharedLock::tryExclusiveLock(uint16_t timeout){
+	return _acquire(&CompactSharedLock::_exclusiveAdmissible, EXCLUSIVE, WAITING_EXCLUSIVE_ONE, true, steady_clock::now() + milliseconds(timeout));
+};
+
+void CompactSharedLock::exclusiveUnlock(){
+	this->_release(EXCLUSIVE);
+};
+
+void CompactSharedLock::rSharedLock(){
+	_acquire(&CompactSharedLock::_readAdmissible, READER_ONE, WAITING_READER_ONE, false, steady_clock::time_point::max());
+};
+
+bool CompactSharedLock::rTrySharedLock(){
+	return this->rTrySharedLock(0);
+};
+
+bool CompactSharedLock::rTrySharedLock(uint16_t timeout){
+	//Like SharedLock, try readers are not counted as future readers
+	return _acquire(&CompactSharedLock::_readAdmissible, READER_ONE, 0, true, steady_clock::now() + milliseconds(timeout));
+};
+
+void CompactSharedLock::rSharedUnlock(){
+	this->_release(READER_ONE);
+};
+
+void CompactSharedLock::wSharedLock(){
+	_acquire(&CompactSharedLock::_writeAdmissible, WRITER_ONE, 0, false, steady_clock::time_point::max());
+};
+
+bool CompactSharedLock::wTrySharedLock(){
+	return this->wTrySharedLock(0);
+};
+
+bool CompactSharedLock::wTrySharedLock(uint16_t timeout){
+	return _acquire(&CompactSharedLock::_writeAdmissible, WRITER_ONE, 0, true, steady_clock::now() + milliseconds(timeout));
+};
+
+void CompactSharedLock::wSharedUnlock(){
+	this->_release(WRITER_ONE);
+};
+
+int32_t CompactSharedLock::getNumberWriters() const {
+	return (_state.load(std::memory_order_relaxed) & WRITER_MASK) >> 16;
+};
+
+int32_t CompactSharedLock::getNumberReaders() const {
+	return _state.load(std::memory_order_relaxed) & READER_MASK;
+};
+
+int32_t CompactSharedLock::getNumberFutureReaders() const {
+	return (_state.load(std::memory_order_relaxed) & WAITING_READER_MASK) >> 32;
+};
@@ -0,0 +1,54 @@
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+
+#include "shared_lock.hpp"
+
+#pragma once
+
+/*
+Word sized shared lock for embedding one per record.
+Whole state lives in one atomic, threads that must wait sleep in a global
+parking lot hashed by lock address. Same reader/writer/exclusive modes and
+READER, WRITER, NONE rules as SharedLock, without thread tracking, reader
+limits or locking of readers/writers.
+State bits:
+	0-15 readers, 16-31 writers, 32-45 waiting readers,
+	46-55 waiting exclusive, 56 exclusive held, 57 parked, 58-59 policy
+*/
+class CompactSharedLock {
+	public:
+	CompactSharedLock(PreferencePolicy policy);
+
+	//exclusive Access
+	void exclusiveLock();
+	bool tryExclusiveLock();
+	bool tryExclusiveLock(uint16_t timeout);
+	void exclusiveUnlock();
+
+	//read Access
+	void rSharedLock();
+	bool rTrySharedLock();
+	bool rTrySharedLock(uint16_t timeout);
+	void rSharedUnlock();
+
+	//write Access
+	void wSharedLock();
+	bool wTrySharedLock();
+	bool wTrySharedLock(uint16_t timeout);
+	void wSharedUnlock();
+
+	int32_t getNumberWriters() const;
+	int32_t getNumberReaders() const;
+	int32_t getNumberFutureReaders() const;
+	private:
+	typedef bool (*f_admissible)(uint64_t state);
+	static bool _readAdmissible(uint64_t state);
+	static bool _writeAdmissible(uint64_t state);
+	static bool _exclusiveAdmissible(uint64_t state);
+	bool _acquire(f_admissible admissible, uint64_t acquired, uint64_t waiting, bool timed, std::chrono::steady_clock::time_point deadline);
+	void _release(uint64_t released);
+	bool _park(uint64_t expected, bool timed, std::chrono::steady_clock::time_point deadline);
+	void _unpark();
+	std::atomic<uint64_t> _state;
+};
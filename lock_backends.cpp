@@ -0,0 +1,313 @@
+#include <errno.h>
+#include <stdexcept>
+#include <thread>
+#include <time.h>
+
+#include "lock_backends.hpp"
+
+using namespace std::chrono;
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 30))
+#define RWLOCK_CLOCKWAIT
+#define RWLOCK_CLOCK CLOCK_MONOTONIC
+#else
+//Older glibc only has timed calls on the realtime clock
+#define RWLOCK_CLOCK CLOCK_REALTIME
+#endif
+
+static struct timespec rwlock_deadline(uint16_t timeout) {
+	struct timespec deadline;
+	clock_gettime(RWLOCK_CLOCK, &deadline);
+	deadline.tv_sec += timeout / 1000;
+	deadline.tv_nsec += (timeout % 1000) * 1000000L;
+	if(deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+	return deadline;
+};
+
+const uint16_t RWLockSharedLock::CANCEL_POLL = 5;
+
+RWLockSharedLock::RWLockSharedLock(PreferencePolicy policy): _future_readers(0), _readers(0), _writers(0){
+	pthread_rwlockattr_t attr;
+	pthread_rwlockattr_init(&attr);
+	switch(policy) {
+		case PreferencePolicy::READER: pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_READER_NP); break;
+		case PreferencePolicy::WRITER: pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP); break;
+		//glibc default, prefers readers
+		case PreferencePolicy::NONE: break;
+		default:
+			pthread_rwlockattr_destroy(&attr);
+			throw std::runtime_error("Policy not supported by rwlock backend");
+	}
+	int ret = pthread_rwlock_init(&_rwlock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+	if(ret != 0) throw std::runtime_error("Unable to create rwlock");
+};
+
+RWLockSharedLock::~RWLockSharedLock(){
+	pthread_rwlock_destroy(&_rwlock);
+};
+
+bool RWLockSharedLock::_timedWrite(uint16_t timeout){
+	if(timeout == 0) return (pthread_rwlock_trywrlock(&_rwlock) == 0);
+	struct timespec deadline = rwlock_deadline(timeout);
+#ifdef RWLOCK_CLOCKWAIT
+	return (pthread_rwlock_clockwrlock(&_rwlock, CLOCK_MONOTONIC, &deadline) == 0);
+#else
+	return (pthread_rwlock_timedwrlock(&_rwlock, &deadline) == 0);
+#endif
+};
+
+void RWLockSharedLock::exclusiveLock(){
+	if(pthread_rwlock_wrlock(&_rwlock) != 0) throw std::runtime_error("Unable to lock rwlock");
+};
+
+bool RWLockSharedLock::exclusiveLock(CancellationToken& token){
+	while(!token.isCancelled()) {
+		if(this->tryExclusiveLock(RWLockSharedLock::CANCEL_POLL)) return true;
+	}
+	return false;
+};
+
+bool RWLockSharedLock::tryExclusiveLock(){
+	return this->tryExclusiveLock(0);
+};
+
+bool RWLockSharedLock::tryExclusiveLock(uint16_t timeout){
+	return _timedWrite(timeout);
+};
+
+void RWLockSharedLock::exclusiveUnlock(){
+	pthread_rwlock_unlock(&_rwlock);
+};
+
+void RWLockSharedLock::rSharedLock(){
+	_future_readers++;
+	int ret = pthread_rwlock_rdlock(&_rwlock);
+	_future_readers--;
+	if(ret != 0) throw std::runtime_error("Unable to lock rwlock");
+	_readers++;
+};
+
+bool RWLockSharedLock::rSharedLock(CancellationToken& token){
+	_future_readers++;
+	bool ret = false;
+	while(!ret and !token.isCancelled()) ret = this->rTrySharedLock(RWLockSharedLock::CANCEL_POLL);
+	_future_readers--;
+	return ret;
+};
+
+bool RWLockSharedLock::rTrySharedLock(){
+	return this->rTrySharedLock(0);
+};
+
+bool RWLockSharedLock::rTrySharedLock(uint16_t timeout){
+	int ret;
+	if(timeout == 0) ret = pthread_rwlock_tryrdlock(&_rwlock);
+	else {
+		struct timespec deadline = rwlock_deadline(timeout);
+#ifdef RWLOCK_CLOCKWAIT
+		ret = pthread_rwlock_clockrdlock(&_rwlock, CLOCK_MONOTONIC, &deadline);
+#else
+		ret = pthread_rwlock_timedrdlock(&_rwlock, &deadline);
+#endif
+	}
+	if(ret != 0) return false;
+	_readers++;
+	return true;
+};
+
+void RWLockSharedLock::rSharedUnlock(){
+	_readers--;
+	pthread_rwlock_unlock(&_rwlock);
+};
+
+void RWLockSharedLock::wSharedLock(){
+	if(pthread_rwlock_wrlock(&_rwlock) != 0) throw std::runtime_error("Unable to lock rwlock");
+	_writers++;
+};
+
+bool RWLockSharedLock::wSharedLock(CancellationToken& token){
+	while(!token.isCancelled()) {
+		if(this->wTrySharedLock(RWLockSharedLock::CANCEL_POLL)) return true;
+	}
+	return false;
+};
+
+bool RWLockSharedLock::wTrySharedLock(){
+	return this->wTrySharedLock(0);
+};
+
+bool RWLockSharedLock::wTrySharedLock(uint16_t timeout){
+	if(!_timedWrite(timeout)) return false;
+	_writers++;
+	return true;
+};
+
+void RWLockSharedLock::wSharedUnlock(){
+	_writers--;
+	pthread_rwlock_unlock(&_rwlock);
+};
+
+int32_t RWLockSharedLock::getNumberWriters() const{
+	return _writers;
+};
+
+int32_t RWLockSharedLock::getNumberReaders() const{
+	return _readers;
+};
+
+int32_t RWLockSharedLock::getNumberFutureReaders() const{
+	return _future_readers;
+};
+
+//No combining, the operation runs under write access of the caller
+bool RWLockSharedLock::combineWrite(std::function<void()> operation, CancellationToken& token){
+	if(!this->wSharedLock(token)) return false;
+	try {
+		operation();
+	}
+	catch (...) {
+		this->wSharedUnlock();
+		throw;
+	}
+	this->wSharedUnlock();
+	return true;
+};
+
+void RWLockSharedLock::registerThread(){};
+
+void RWLockSharedLock::unregisterThread(){};
+
+#ifdef SHARED_LOCK_STD_BACKEND
+const uint16_t StdSharedLock::CANCEL_POLL = 5;
+
+StdSharedLock::StdSharedLock(PreferencePolicy policy): _future_readers(0), _readers(0), _writers(0){
+	if(policy != PreferencePolicy::READER and policy != PreferencePolicy::WRITER and policy != PreferencePolicy::NONE) throw std::runtime_error("Policy not supported by std backend");
+};
+
+bool StdSharedLock::_timedWrite(uint16_t timeout){
+	steady_clock::time_point deadline = steady_clock::now() + milliseconds(timeout);
+	while(!_mutex.try_lock()) {
+		if(steady_clock::now() >= deadline) return false;
+		std::this_thread::sleep_for(milliseconds(1));
+	}
+	return true;
+};
+
+void StdSharedLock::exclusiveLock(){
+	_mutex.lock();
+};
+
+bool StdSharedLock::exclusiveLock(CancellationToken& token){
+	while(!token.isCancelled()) {
+		if(this->tryExclusiveLock(StdSharedLock::CANCEL_POLL)) return true;
+	}
+	return false;
+};
+
+bool StdSharedLock::tryExclusiveLock(){
+	return this->tryExclusiveLock(0);
+};
+
+bool StdSharedLock::tryExclusiveLock(uint16_t timeout){
+	return _timedWrite(timeout);
+};
+
+void StdSharedLock::exclusiveUnlock(){
+	_mutex.unlock();
+};
+
+void StdSharedLock::rSharedLock(){
+	_future_readers++;
+	_mutex.lock_shared();
+	_future_readers--;
+	_readers++;
+};
+
+bool StdSharedLock::rSharedLock(CancellationToken& token){
+	_future_readers++;
+	bool ret = false;
+	while(!ret and !token.isCancelled()) ret = this->rTrySharedLock(StdSharedLock::CANCEL_POLL);
+	_future_readers--;
+	return ret;
+};
+
+bool StdSharedLock::rTrySharedLock(){
+	return this->rTrySharedLock(0);
+};
+
+bool StdSharedLock::rTrySharedLock(uint16_t timeout){
+	steady_clock::time_point deadline = steady_clock::now() + milliseconds(timeout);
+	while(!_mutex.try_lock_shared()) {
+		if(steady_clock::now() >= deadline) return false;
+		std::this_thread::sleep_for(milliseconds(1));
+	}
+	_readers++;
+	return true;
+};
+
+void StdSharedLock::rSharedUnlock(){
+	_readers--;
+	_mutex.unlock_shared();
+};
+
+void StdSharedLock::wSharedLock(){
+	_mutex.lock();
+	_writers++;
+};
+
+bool StdSharedLock::wSharedLock(CancellationToken& token){
+	while(!token.isCancelled()) {
+		if(this->wTrySharedLock(StdSharedLock::CANCEL_POLL)) return true;
+	}
+	return false;
+};
+
+bool StdSharedLock::wTrySharedLock(){
+	return this->wTrySharedLock(0);
+};
+
+bool StdSharedLock::wTrySharedLock(uint16_t timeout){
+	if(!_timedWrite(timeout)) return false;
+	_writers++;
+	return true;
+};
+
+void StdSharedLock::wSharedUnlock(){
+	_writers--;
+	_mutex.unlock();
+};
+
+int32_t StdSharedLock::getNumberWriters() const{
+	return _writers;
+};
+
+int32_t StdSharedLock::getNumberReaders() const{
+	return _readers;
+};
+
+int32_t StdSharedLock::getNumberFutureReaders() const{
+	return _future_readers;
+};
+
+//No combining, the operation runs under write access of the caller
+bool StdSharedLock::combineWrite(std::function<void()> operation, CancellationToken& token){
+	if(!this->wSharedLock(token)) return false;
+	try {
+		operation();
+	}
+	catch (...) {
+		this->wSharedUnlock();
+		throw;
+	}
+	this->wSharedUnlock();
+	return true;
+};
+
+void StdSharedLock::registerThread(){};
+
+void StdSharedLock::unregisterThread(){};
+#endif
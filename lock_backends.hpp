@@ -0,0 +1,128 @@
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <pthread.h>
+#include <stdint.h>
+
+#if __cplusplus >= 201703L
+#include <shared_mutex>
+#define SHARED_LOCK_STD_BACKEND
+#endif
+
+#include "shared_lock.hpp"
+
+#pragma once
+
+/*
+SharedLock reader/writer/exclusive API over pthread_rwlock_t, as a baseline
+and fallback. READER and WRITER map to the glibc rwlock preferences (WRITER
+is PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP). NONE keeps the glibc
+default, PTHREAD_RWLOCK_PREFER_READER_NP, so it behaves as READER.
+Write access is exclusive here, same as exclusiveLock, and nested
+acquisitions are not checked.
+Cancellable waits poll timed tries every CANCEL_POLL ms, combineWrite runs
+the operation under write access without combining, thread registration is
+not needed.
+*/
+class RWLockSharedLock: public SharedLockInterface {
+	public:
+	RWLockSharedLock(PreferencePolicy policy);
+	~RWLockSharedLock();
+
+	//exclusive Access
+	void exclusiveLock();
+	bool exclusiveLock(CancellationToken& token);
+	bool tryExclusiveLock();
+	bool tryExclusiveLock(uint16_t timeout);
+	void exclusiveUnlock();
+
+	//read Access
+	void rSharedLock();
+	bool rSharedLock(CancellationToken& token);
+	bool rTrySharedLock();
+	bool rTrySharedLock(uint16_t timeout);
+	void rSharedUnlock();
+
+	//write Access
+	void wSharedLock();
+	bool wSharedLock(CancellationToken& token);
+	bool wTrySharedLock();
+	bool wTrySharedLock(uint16_t timeout);
+	void wSharedUnlock();
+
+	bool combineWrite(std::function<void()> operation, CancellationToken& token);
+	int32_t getNumberWriters() const;
+	int32_t getNumberReaders() const;
+	int32_t getNumberFutureReaders() const;
+	void registerThread();
+	void unregisterThread();
+	static const uint16_t CANCEL_POLL;
+	private:
+	bool _timedWrite(uint16_t timeout);
+	pthread_rwlock_t _rwlock;
+	std::atomic<int32_t> _future_readers;
+	std::atomic<int32_t> _readers;
+	std::atomic<int32_t> _writers;
+};
+
+#ifdef SHARED_LOCK_STD_BACKEND
+/*
+Same API over std::shared_mutex (C++17). The mutex has no preference, any
+READER, WRITER or NONE policy gets its implementation defined one.
+shared_mutex has no timed calls, tries with a timeout poll every ms.
+*/
+class StdSharedLock: public SharedLockInterface {
+	public:
+	StdSharedLock(PreferencePolicy policy);
+
+	//exclusive Access
+	void exclusiveLock();
+	bool exclusiveLock(CancellationToken& token);
+	bool tryExclusiveLock();
+	bool tryExclusiveLock(uint16_t timeout);
+	void exclusiveUnlock();
+
+	//read Access
+	void rSharedLock();
+	bool rSharedLock(CancellationToken& token);
+	bool rTrySharedLock();
+	bool rTrySharedLock(uint16_t timeout);
+	void rSharedUnlock();
+
+	//write Access
+	void wSharedLock();
+	bool wSharedLock(CancellationToken& token);
+	bool wTrySharedLock();
+	bool wTrySharedLock(uint16_t timeout);
+	void wSharedUnlock();
+
+	bool combineWrite(std::function<void()> operation, CancellationToken& token);
+	int32_t getNumberWriters() const;
+	int32_t getNumberReaders() const;
+	int32_t getNumberFutureReaders() const;
+	void registerThread();
+	void unregisterThread();
+	static const uint16_t CANCEL_POLL;
+	private:
+	bool _timedWrite(uint16_t timeout);
+	std::atomic<int32_t> _future_readers;
+	std::shared_mutex _mutex;
+	std::atomic<int32_t> _readers;
+	std::atomic<int32_t> _writers;
+};
+#endif
+
+/*
+Backend picked at compile time for code written against BackendSharedLock:
+-DSHARED_LOCK_BACKEND_PTHREAD, -DSHARED_LOCK_BACKEND_STD (C++17) or SharedLock.
+*/
+#if defined(SHARED_LOCK_BACKEND_PTHREAD)
+typedef RWLockSharedLock BackendSharedLock;
+#elif defined(SHARED_LOCK_BACKEND_STD)
+#ifndef SHARED_LOCK_STD_BACKEND
+#error "SHARED_LOCK_BACKEND_STD needs C++17"
+#endif
+typedef StdSharedLock BackendSharedLock;
+#else
+typedef SharedLock BackendSharedLock;
+#endif
@@ -0,0 +1,90 @@
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string.h>
+
+#include "lock_trace.hpp"
+
+using namespace std::chrono;
+
+static_assert(sizeof(TraceRecord) == 32, "Trace records are 32 bytes on disk");
+
+const char LockTraceRecorder::MAGIC[4] = {'S', 'L', 'T', 'R'};
+const uint32_t LockTraceRecorder::VERSION = 1;
+
+LockTraceRecorder::LockTraceRecorder(): _start(steady_clock::now()){};
+
+void LockTraceRecorder::record(std::thread::id thread, AccessMode mode, steady_clock::time_point arrival, steady_clock::time_point acquired, steady_clock::time_point released){
+	TraceRecord record;
+	memset(&record, 0, sizeof(record));
+	record.mode = static_cast<uint8_t>(mode);
+	record.arrival = (arrival > _start) ? duration_cast<nanoseconds>(arrival - _start).count() : 0;
+	record.wait = duration_cast<nanoseconds>(acquired - arrival).count();
+	record.hold = duration_cast<nanoseconds>(released - acquired).count();
+	std::unique_lock<std::mutex> lk(_lock);
+	//Thread ids are stored as small indexes in order of appearance
+	auto known = _threads.find(thread);
+	if(known == _threads.end()) known = _threads.insert(std::make_pair(thread, (uint32_t) _threads.size())).first;
+	record.thread = known->second;
+	_records.push_back(record);
+};
+
+std::vector<TraceRecord> LockTraceRecorder::getRecords() const {
+	std::unique_lock<std::mutex> lk(_lock);
+	std::vector<TraceRecord> records(_records);
+	//Records are appended on release, replay wants them by arrival
+	std::sort(records.begin(), records.end(), [](const TraceRecord& a, const TraceRecord& b) {return a.arrival < b.arrival;});
+	return records;
+};
+
+size_t LockTraceRecorder::size() const {
+	std::unique_lock<std::mutex> lk(_lock);
+	return _records.size();
+};
+
+bool LockTraceRecorder::save(const std::string& path) const {
+	std::vector<TraceRecord> records = this->getRecords();
+	std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+	if(!file) return false;
+	file.write(LockTraceRecorder::MAGIC, sizeof(LockTraceRecorder::MAGIC));
+	file.write(reinterpret_cast<const char*>(&LockTraceRecorder::VERSION), sizeof(LockTraceRecorder::VERSION));
+	if(!records.empty()) file.write(reinterpret_cast<const char*>(&records[0]), records.size() * sizeof(TraceRecord));
+	return file.good();
+};
+
+bool LockTraceRecorder::load(const std::string& path, std::vector<TraceRecord>& records){
+	std::ifstream file(path.c_str(), std::ios::binary);
+	char magic[4];
+	uint32_t version = 0;
+	file.read(magic, sizeof(magic));
+	file.read(reinterpret_cast<char*>(&version), sizeof(version));
+	if(!file or memcmp(magic, LockTraceRecorder::MAGIC, sizeof(magic)) != 0 or version != LockTraceRecorder::VERSION) return false;
+	TraceRecord record;
+	records.clear();
+	while(file.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+		if(record.mode > static_cast<uint8_t>(AccessMode::EXCLUSIVE)) return false;
+		records.push_back(record);
+	}
+	return true;
+};
+
+ReplayResult::ReplayResult(): operations(0), duration(0), throughput(0){};
+
+uint64_t ReplayResult::percentile(AccessMode mode, double percentile) const {
+	const std::vector<uint64_t>& sorted = waits[static_cast<uint8_t>(mode)];
+	if(sorted.empty()) return 0;
+	size_t index = (size_t) ((percentile / 100.0) * (sorted.size() - 1));
+	return sorted[index];
+};
+
+void ReplayResult::print(std::ostream& os) const {
+	const char* names[3] = {"read", "write", "exclusive"};
+	os<<"Operations: "<<operations<<" Duration: "<<duration<<" us Throughput: "<<std::fixed<<std::setprecision(1)<<throughput<<" ops/s"<<std::endl;
+	for(uint8_t index = 0; index < 3; index++) {
+		AccessMode mode = static_cast<AccessMode>(index);
+		if(waits[index].empty()) continue;
+		os<<"\t"<<std::left<<std::setw(10)<<names[index]<<" count: "<<waits[index].size()
+			<<" wait us p50: "<<percentile(mode, 50)<<" p90: "<<percentile(mode, 90)
+			<<" p99: "<<percentile(mode, 99)<<" max: "<<waits[index].back()<<std::endl;
+	}
+};
@@ -0,0 +1,102 @@
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "shared_lock.hpp"
+
+#pragma once
+
+/*
+One lock operation as stored in a trace file, times in ns.
+arrival is relative to the recorder start, wait and hold are durations.
+*/
+struct TraceRecord {
+	uint32_t thread;
+	uint8_t mode;
+	uint8_t reserved[3];
+	uint64_t arrival;
+	uint64_t wait;
+	uint64_t hold;
+};
+
+/*
+Collects SharedLock operations in memory (see SharedLock::setTraceRecorder)
+and saves them as a compact binary file: 8 byte header, 32 byte records.
+*/
+class LockTraceRecorder {
+	public:
+	LockTraceRecorder();
+	void record(std::thread::id thread, AccessMode mode, std::chrono::steady_clock::time_point arrival,
+		std::chrono::steady_clock::time_point acquired, std::chrono::steady_clock::time_point released);
+	std::vector<TraceRecord> getRecords() const;
+	size_t size() const;
+	bool save(const std::string& path) const;
+	static bool load(const std::string& path, std::vector<TraceRecord>& records);
+	static const char MAGIC[4];
+	static const uint32_t VERSION;
+	private:
+	mutable std::mutex _lock;
+	std::vector<TraceRecord> _records;
+	std::chrono::steady_clock::time_point _start;
+	std::map<std::thread::id, uint32_t> _threads;
+};
+
+/*Outcome of a replay, waits in us*/
+struct ReplayResult {
+	ReplayResult();
+	uint64_t operations;
+	uint64_t duration;
+	double throughput;
+	std::vector<uint64_t> waits[3];
+	//percentile in [0, 100] of the waits of one mode
+	uint64_t percentile(AccessMode mode, double percentile) const;
+	void print(std::ostream& os) const;
+};
+
+/*
+Re-drives the recorded arrivals and hold times against any lock exposing
+the SharedLock acquisition calls: one thread per recorded thread, each
+operation starts at its recorded arrival (or when the previous one ends).
+*/
+template <class Lock>
+ReplayResult replayTrace(const std::vector<TraceRecord>& records, Lock& lock) {
+	typedef std::chrono::steady_clock clock;
+	std::map<uint32_t, std::vector<TraceRecord>> by_thread;
+	for(auto& record: records) by_thread[record.thread].push_back(record);
+	std::mutex result_lock;
+	ReplayResult result;
+	std::vector<std::thread> threads;
+	clock::time_point start = clock::now() + std::chrono::milliseconds(10);
+	for(auto& recorded: by_thread) {
+		const std::vector<TraceRecord>* operations = &recorded.second;
+		threads.push_back(std::thread([&lock, &result, &result_lock, operations, start] {
+			std::vector<uint64_t> waits[3];
+			for(auto& operation: *operations) {
+				std::this_thread::sleep_until(start + std::chrono::nanoseconds(operation.arrival));
+				clock::time_point arrival = clock::now();
+				AccessMode mode = static_cast<AccessMode>(operation.mode);
+				if(mode == AccessMode::READ) lock.rSharedLock();
+				else if(mode == AccessMode::WRITE) lock.wSharedLock();
+				else lock.exclusiveLock();
+				waits[operation.mode].push_back(std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - arrival).count());
+				std::this_thread::sleep_for(std::chrono::nanoseconds(operation.hold));
+				if(mode == AccessMode::READ) lock.rSharedUnlock();
+				else if(mode == AccessMode::WRITE) lock.wSharedUnlock();
+				else lock.exclusiveUnlock();
+			}
+			std::unique_lock<std::mutex> lk(result_lock);
+			for(uint32_t index = 0; index < 3; index++) result.waits[index].insert(result.waits[index].end(), waits[index].begin(), waits[index].end());
+		}));
+	}
+	std::for_each(threads.begin(), threads.end(), [](std::thread& t){t.join();});
+	result.operations = records.size();
+	result.duration = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count();
+	result.throughput = (result.duration == 0) ? 0 : (result.operations * 1000000.0) / result.duration;
+	for(uint32_t index = 0; index < 3; index++) std::sort(result.waits[index].begin(), result.waits[index].end());
+	return result;
+};
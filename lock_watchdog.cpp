@@ -0,0 +1,80 @@
+#include "lock_watchdog.hpp"
+
+using namespace std::chrono;
+
+LockWatchdog::LockWatchdog(uint32_t hold_budget, uint32_t wait_budget, uint16_t interval, f_report report): _hold_budget(hold_budget), _interval(interval), _report(report), _reports(0), _running(false), _thread(NULL), _wait_budget(wait_budget){};
+
+LockWatchdog::~LockWatchdog(){
+	this->stop();
+};
+
+void LockWatchdog::watch(SharedLock* lock, const std::string& name){
+	lock->setActivityTracking(true);
+	std::unique_lock<std::mutex> lk(_lock);
+	_locks[lock] = name;
+};
+
+//Tracking is left on, other watchdogs may sample the lock
+void LockWatchdog::unwatch(SharedLock* lock){
+	std::unique_lock<std::mutex> lk(_lock);
+	_locks.erase(lock);
+};
+
+void LockWatchdog::start(){
+	std::unique_lock<std::mutex> lk(_lock);
+	if(_running) return;
+	_running = true;
+	_thread = new std::thread(&LockWatchdog::_run, this);
+};
+
+void LockWatchdog::stop(){
+	std::unique_lock<std::mutex> lk(_lock);
+	if(!_running) return;
+	_running = false;
+	_stop_cv.notify_all();
+	std::thread* thread = _thread;
+	_thread = NULL;
+	lk.unlock();
+	thread->join();
+	delete thread;
+};
+
+void LockWatchdog::_run(){
+	std::unique_lock<std::mutex> lk(_lock);
+	while(_running) {
+		lk.unlock();
+		this->sample();
+		lk.lock();
+		_stop_cv.wait_for(lk, milliseconds(_interval), [this] {return !this->_running;});
+	}
+};
+
+/*Reports are made without _lock held, the callback may call back into us*/
+void LockWatchdog::sample(){
+	steady_clock::time_point now = steady_clock::now();
+	std::vector<LockWatchdogReport> reports;
+	{
+		std::unique_lock<std::mutex> lk(_lock);
+		std::set<std::tuple<const SharedLock*, std::thread::id, int64_t>> seen;
+		for(auto& watched: _locks) {
+			for(auto& activity: watched.first->getActivity()) {
+				uint32_t budget = activity.waiting ? _wait_budget : _hold_budget;
+				uint64_t duration = duration_cast<milliseconds>(now - activity.since).count();
+				if(budget == 0 or duration < budget) continue;
+				auto key = std::make_tuple((const SharedLock*) watched.first, activity.thread, (int64_t) activity.since.time_since_epoch().count());
+				seen.insert(key);
+				if(_reported.count(key) > 0) continue;
+				reports.push_back({watched.first, watched.second, activity.thread, activity.mode, activity.waiting, duration});
+			}
+		}
+		//Forget holds and waits that ended
+		_reported.swap(seen);
+		_reports += reports.size();
+	}
+	for(auto& report: reports) _report(report);
+};
+
+uint64_t LockWatchdog::getReports() const{
+	std::unique_lock<std::mutex> lk(_lock);
+	return _reports;
+};
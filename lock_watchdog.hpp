@@ -0,0 +1,61 @@
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "shared_lock.hpp"
+
+#pragma once
+
+//One holder or waiter past its budget
+struct LockWatchdogReport {
+	const SharedLock* lock;
+	std::string name;
+	std::thread::id thread;
+	AccessMode mode;
+	bool waiting;
+	//ms held or waited when sampled
+	uint64_t duration;
+};
+
+/*
+Background sampler of SharedLock activity. Every interval ms it reads the
+activity slots of the watched locks, which never takes their internal mutex,
+and reports holders past hold_budget ms and waiters past wait_budget ms.
+Each hold or wait is reported once. 0 disables a budget.
+*/
+class LockWatchdog {
+	public:
+	typedef std::function<void(const LockWatchdogReport&)> f_report;
+	LockWatchdog(uint32_t hold_budget, uint32_t wait_budget, uint16_t interval, f_report report);
+	~LockWatchdog();
+	//Enables activity tracking on lock
+	void watch(SharedLock* lock, const std::string& name);
+	void unwatch(SharedLock* lock);
+	void start();
+	void stop();
+	//One sampling pass, start() runs it every interval
+	void sample();
+	uint64_t getReports() const;
+	private:
+	void _run();
+	uint32_t _hold_budget;
+	uint16_t _interval;
+	mutable std::mutex _lock;
+	std::map<SharedLock*, std::string> _locks;
+	f_report _report;
+	//lock, thread, start of the hold or wait, already reported
+	std::set<std::tuple<const SharedLock*, std::thread::id, int64_t>> _reported;
+	uint64_t _reports;
+	bool _running;
+	std::condition_variable _stop_cv;
+	std::thread* _thread;
+	uint32_t _wait_budget;
+};
@@ -1,15 +1,30 @@
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstddef>
+#include <cstdio>
+#include <future>
 #include <iostream>
 #include <iomanip> 
+#include <stdexcept>
+#include <string.h>
+#include <sys/wait.h>
+#include <thread>
 #include <unistd.h>
 #include <utility>
 #include <vector>
 #include "test_objects.hpp"
+#include "cohort_lock.hpp"
+#include "compact_lock.hpp"
+#include "lock_backends.hpp"
+#include "lock_trace.hpp"
+#include "lock_watchdog.hpp"
+#include "process_lock.hpp"
 #include "shared_lock.hpp"
+#include "workload_driver.hpp"
 
 
-std::vector<Writer*>& createNWriters(SharedLock& shared_lock, uint16_t n) {
+std::vector<Writer*>& createNWriters(SharedLockInterface& shared_lock, uint16_t n) {
 	std::vector<Writer*>* w_vector = new std::vector<Writer*>(n);  
 	for(uint8_t index = 0; index < n; index++) w_vector->operator[](index) = new Writer(&shared_lock);
 	return *w_vector;
@@ -25,7 +40,7 @@ void stopWriters(std::vector<Writer*>& writers) {
 };
 
 
-std::vector<Reader*>& createNReaders(SharedLock& shared_lock, uint16_t n) {
+std::vector<Reader*>& createNReaders(SharedLockInterface& shared_lock, uint16_t n) {
 	std::vector<Reader*>* r_vector = new std::vector<Reader*>(n);  
 	for(uint8_t index = 0; index<n; index++) r_vector->operator[](index) = new Reader(&shared_lock);
 	return *r_vector;
@@ -227,7 +242,7 @@ bool testExclusiveThread() {
 	auto memory = get_memory_space();
 	memory->restartMemory();
 	bool ret = true;
-	SharedLock _shared_lock(PreferencePolicy::WRITER);
+	BackendSharedLock _shared_lock(PreferencePolicy::WRITER);
 	auto writers_vector = createNWriters(_shared_lock, NUM_WRITERS);
 	startWriters(writers_vector);
 	uint32_t value = memory->getSize();		
@@ -425,12 +440,1199 @@ bool testExclusiveAccess() {
 	return ret;
 };
 
+bool testMemoryView() {
+	/*
+	Write known data and check view points to it without copying
+	*/
+	bool ret = true;
+	MemorySpace memory(64);
+	uint8_t data[4] = {'a', 'b', 'c', 'd'};
+	memory.write(data, 4);
+	MemoryView view = memory.view();
+	if(view.size != 4 || memcmp(view.data, data, 4) != 0) ret = false;
+	view = memory.view(2);
+	if(view.offset != 2 || view.size != 2 || view.data[0] != 'c') ret = false;
+	if(memory.view(4).size != 0) ret = false;
+	std::cout<<"\tView size: "<<view.size<<" offset: "<<view.offset<<std::endl;
+	return ret;
+};
+
+bool testMemoryCursors() {
+	/*
+	Two cursors: each readNew only returns bytes appended since its last read
+	*/
+	bool ret = true;
+	MemorySpace memory(64);
+	uint8_t data[4] = {'a', 'b', 'c', 'd'};
+	uint32_t cursor_1 = memory.openCursor();
+	uint32_t cursor_2 = memory.openCursor();
+	memory.write(data, 2);
+	if(memory.readNew(cursor_1).size != 2) ret = false;
+	memory.write(data + 2, 2);
+	MemoryView view = memory.readNew(cursor_1);
+	if(view.offset != 2 || view.size != 2 || view.data[0] != 'c') ret = false;
+	if(memory.readNew(cursor_1).size != 0) ret = false;
+	if(memory.getLowWatermark() != 0) ret = false;
+	if(memory.readNew(cursor_2).size != 4) ret = false;
+	if(memory.getLowWatermark() != 4) ret = false;
+	std::cout<<"\tLow Watermark: "<<memory.getLowWatermark()<<std::endl;
+	memory.closeCursor(cursor_1);
+	memory.closeCursor(cursor_2);
+	return ret;
+};
+
+bool testWaitForData() {
+	/*
+	Waiter blocks until a writer appends past its position, times out otherwise
+	An idle Reader sleeping in waitForData stops without waiting the timeout
+	*/
+	bool ret = true;
+	MemorySpace memory(64);
+	uint8_t data[1] = {'a'};
+	if(memory.waitForData(0, 10) == true) ret = false;
+	std::thread writer([&memory, &data] {usleep(50*1000); memory.write(data, 1);});
+	if(memory.waitForData(0, 1000) == false) ret = false;
+	writer.join();
+	std::cout<<"\tMemory size after wait: "<<memory.getSize()<<std::endl;
+
+	BackendSharedLock _shared_lock(PreferencePolicy::NONE);
+	Reader reader(&_shared_lock);
+	reader.readContinously();
+	usleep(50*1000);
+	auto start = std::chrono::steady_clock::now();
+	reader.stop();
+	uint64_t elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	std::cout<<"\tIdle reader stopped in: "<<elapsed<<" ms"<<std::endl;
+	if(elapsed > 20) ret = false;
+	return ret;
+};
+
+bool testBatchingWriter() {
+	/*
+	Same run time, batched writer must commit far more data than per byte writer
+	*/
+	bool RUN = true;
+	if(!RUN) return false;
+	uint16_t BATCH_SIZE = 64;
+
+	bool ret = true;
+	auto memory = get_memory_space();
+	BackendSharedLock _shared_lock(PreferencePolicy::NONE);
+	Writer writer(&_shared_lock);
+	memory->restartMemory();
+	writer.writeContinously();
+	usleep(200*1000);
+	writer.stop();
+	size_t unbatched = memory->getSize();
+	memory->restartMemory();
+	writer.setBatching(BATCH_SIZE, 10);
+	writer.writeContinously();
+	usleep(200*1000);
+	writer.stop();
+	size_t batched = memory->getSize();
+	std::cout<<"\tUnbatched: "<<unbatched<<" Batched: "<<batched<<std::endl;
+	if(batched <= unbatched || (batched % BATCH_SIZE) != 0) ret = false;
+	return ret;
+};
+
+bool testFlatCombining() {
+	/*
+	N threads combine unprotected increments, none must be lost
+	Exceptions thrown by an operation reach the thread that published it
+	A flat combining Writer held back by lockWriters stops at once, also after close
+	*/
+	bool RUN = true;
+	if(!RUN) return false;
+	uint32_t NUM_THREADS = 8;
+	uint32_t NUM_OPERATIONS = 1000;
+
+	bool ret = true;
+	SharedLock _shared_lock(PreferencePolicy::NONE);
+	uint32_t counter = 0;
+	std::vector<std::thread> threads;
+	for(uint32_t index = 0; index < NUM_THREADS; index++) {
+		threads.push_back(std::thread([&] {
+			for(uint32_t op = 0; op < NUM_OPERATIONS; op++) _shared_lock.combineWrite([&counter] {counter++;});
+		}));
+	}
+	std::for_each(threads.begin(), threads.end(), [](std::thread& t){t.join();});
+	std::cout<<"\tCounter: "<<counter<<" Expected: "<<NUM_THREADS*NUM_OPERATIONS<<std::endl;
+	if(counter != NUM_THREADS*NUM_OPERATIONS) ret = false;
+	try {
+		_shared_lock.combineWrite([] {throw std::runtime_error("combined");});
+		ret = false;
+	}
+	catch (std::runtime_error&) {}
+	if(_shared_lock.getNumberWriters() != 0) ret = false;
+
+	CancellationToken token;
+	token.cancel();
+	if(_shared_lock.combineWrite([&counter] {counter++;}, token) or counter != NUM_THREADS*NUM_OPERATIONS) ret = false;
+	_shared_lock.lockWriters();
+	Writer writer(&_shared_lock);
+	writer.setFlatCombining(true);
+	writer.writeContinously();
+	usleep(50*1000);
+	auto start = std::chrono::steady_clock::now();
+	writer.stop();
+	uint64_t elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	std::cout<<"\tWriter stopped in: "<<elapsed<<" ms"<<std::endl;
+	if(elapsed > 50) ret = false;
+	writer.writeContinously();
+	usleep(50*1000);
+	_shared_lock.close();
+	writer.stop();
+	_shared_lock.unlockWriters();
+	try {
+		_shared_lock.combineWrite([&counter] {counter++;});
+		ret = false;
+	}
+	catch (LockCancelled&) {}
+	return ret;
+};
+
+bool testAsyncAcquisition() {
+	/*
+	Async reader queued behind a writer is granted on release by the releasing thread
+	Future writer is ready only once readers are gone
+	With an executor callbacks are handed over instead of run inline
+	*/
+	bool ret = true;
+	SharedLock _shared_lock(PreferencePolicy::NONE);
+	bool granted = false;
+	_shared_lock.wSharedLock();
+	_shared_lock.asyncRSharedLock([&granted] {granted = true;});
+	if(granted || _shared_lock.getNumberFutureReaders() != 1) ret = false;
+	_shared_lock.wSharedUnlock();
+	if(!granted || _shared_lock.getNumberReaders() != 1) ret = false;
+	std::future<void> write_access = _shared_lock.wSharedLockFuture();
+	if(write_access.wait_for(std::chrono::milliseconds(10)) == std::future_status::ready) ret = false;
+	_shared_lock.rSharedUnlock();
+	if(write_access.wait_for(std::chrono::milliseconds(10)) != std::future_status::ready) ret = false;
+	std::vector<SharedLock::f_callback> posted;
+	_shared_lock.setExecutor([&posted](SharedLock::f_callback callback) {posted.push_back(callback);});
+	granted = false;
+	_shared_lock.asyncExclusiveLock([&granted] {granted = true;});
+	_shared_lock.wSharedUnlock();
+	if(granted || posted.size() != 1) ret = false;
+	std::for_each(posted.begin(), posted.end(), [](SharedLock::f_callback& callback){callback();});
+	if(!granted) ret = false;
+	std::cout<<"\tAsync exclusive granted: "<<granted<<" Readers: "<<_shared_lock.getNumberReaders()<<" Writers: "<<_shared_lock.getNumberWriters()<<std::endl;
+	_shared_lock.exclusiveUnlock();
+	//A throwing callback keeps neither the next one from running nor the error from the releasing thread
+	_shared_lock.setExecutor(SharedLock::f_executor());
+	_shared_lock.wSharedLock();
+	granted = false;
+	_shared_lock.asyncRSharedLock([] {throw std::runtime_error("Callback failed");});
+	_shared_lock.asyncRSharedLock([&granted] {granted = true;});
+	try {
+		_shared_lock.wSharedUnlock();
+		ret = false;
+	}
+	catch (std::runtime_error& e) {
+	}
+	if(!granted || _shared_lock.getNumberReaders() != 2) ret = false;
+	_shared_lock.rSharedUnlock();
+	_shared_lock.rSharedUnlock();
+	return ret;
+};
+
+bool testWorkloadDriver() {
+	/*
+	Many logical clients over a small worker pool, both kinds must make progress
+	*/
+	bool RUN = true;
+	if(!RUN) return false;
+	uint32_t NUM_WORKERS = 2;
+	uint32_t NUM_READERS = 500;
+	uint32_t NUM_WRITERS = 5;
+
+	bool ret = true;
+	BackendSharedLock _shared_lock(PreferencePolicy::NONE);
+	WorkloadDriver driver(NUM_WORKERS, true);
+	driver.addReaders(&_shared_lock, NUM_READERS, 100, 0);
+	driver.addWriters(&_shared_lock, NUM_WRITERS, 20, 1000);
+	driver.start();
+	usleep(500*1000);
+	driver.stop();
+	std::cout<<"\tRead ops: "<<driver.getReadOperations()<<" avg wait: "<<driver.getAverageReadWait()<<" us"
+		<<" Write ops: "<<driver.getWriteOperations()<<" avg wait: "<<driver.getAverageWriteWait()<<" us"<<std::endl;
+	if(driver.getReadOperations() == 0 || driver.getWriteOperations() == 0) ret = false;
+	if(_shared_lock.getNumberReaders() != 0 || _shared_lock.getNumberWriters() != 0) ret = false;
+	return ret;
+};
+
+bool testWriterAging() {
+	/*
+	READER policy with overlapping readers: writer must get in once it waited past the bound
+	A starving writer giving up lets in the async reader it held back
+	*/
+	bool RUN = true;
+	if(!RUN) return false;
+	uint32_t NUM_READERS = 4;
+	uint32_t MAX_WRITER_WAIT = 50;
+
+	bool ret = true;
+	SharedLock _shared_lock(PreferencePolicy::READER);
+	_shared_lock.setMaxWriterWait(MAX_WRITER_WAIT);
+	RWOut out;
+	std::vector<std::thread> readers;
+	for(uint32_t index = 0; index < NUM_READERS; index++) {
+		readers.push_back(std::thread([&] {
+			while(!out.status()) {
+				_shared_lock.rSharedLock();
+				usleep(5*1000);
+				_shared_lock.rSharedUnlock();
+			}
+		}));
+	}
+	usleep(50*1000);
+	if(_shared_lock.wTrySharedLock(1000) == false) ret = false;
+	else _shared_lock.wSharedUnlock();
+	out.set();
+	std::for_each(readers.begin(), readers.end(), [](std::thread& t){t.join();});
+	std::cout<<"\tStarvation events: "<<_shared_lock.getWriterStarvationEvents()<<" Longest writer wait: "<<_shared_lock.getLongestWriterWait()<<" ms"<<std::endl;
+	if(_shared_lock.getLongestWriterWait() >= 1000) ret = false;
+
+	_shared_lock.setMaxWriterWait(10);
+	std::thread holder([&] {
+		_shared_lock.rSharedLock();
+		usleep(400*1000);
+		_shared_lock.rSharedUnlock();
+	});
+	usleep(20*1000);
+	std::atomic<bool> granted(false);
+	std::thread writer([&] {
+		if(_shared_lock.wTrySharedLock(100)) ret = false;
+	});
+	usleep(50*1000);
+	_shared_lock.asyncRSharedLock([&granted] {granted = true;});
+	writer.join();
+	if(!granted) ret = false;
+	else _shared_lock.rSharedUnlock();
+	holder.join();
+	return ret;
+};
+
+bool testPriorityAdmission() {
+	/*
+	Low priority writer arrives first, high priority reader later.
+	On release both are admissible for NONE, the reader must go first.
+	ROUNDROBIN and XCLUSIVE refuse read and write priorities.
+	*/
+	bool ret = true;
+	SharedLock _shared_lock(PreferencePolicy::NONE);
+	_shared_lock.setPriorityBoost(true);
+	std::mutex order_lock;
+	std::vector<AccessMode> order;
+	_shared_lock.wSharedLock();
+	std::thread writer([&] {
+		_shared_lock.wSharedLock(SharedLock::DEFAULT_PRIORITY);
+		{
+			std::unique_lock<std::mutex> lk(order_lock);
+			order.push_back(AccessMode::WRITE);
+		}
+		_shared_lock.wSharedUnlock();
+	});
+	usleep(20*1000);
+	std::thread reader([&] {
+		_shared_lock.rSharedLock(10);
+		{
+			std::unique_lock<std::mutex> lk(order_lock);
+			order.push_back(AccessMode::READ);
+		}
+		usleep(10*1000);
+		_shared_lock.rSharedUnlock();
+	});
+	usleep(20*1000);
+	_shared_lock.wSharedUnlock();
+	writer.join();
+	reader.join();
+	if(order.size() != 2 || order[0] != AccessMode::READ) ret = false;
+	std::cout<<"\tFirst admitted: "<<((order.size() > 0 && order[0] == AccessMode::READ) ? "Reader" : "Writer")<<std::endl;
+	_shared_lock.setPriorityBoost(false);
+	SharedLock _exclusive_lock(PreferencePolicy::XCLUSIVE);
+	try {
+		_exclusive_lock.rTrySharedLock(0, 10);
+		ret = false;
+	}
+	catch (std::runtime_error&) {}
+	if(!_exclusive_lock.wTrySharedLock(0, SharedLock::DEFAULT_PRIORITY)) ret = false;
+	else _exclusive_lock.wSharedUnlock();
+	return ret;
+};
+
+bool testExclusiveQueue() {
+	/*
+	Exclusive requests queued behind a reader are served in arrival order,
+	a reader arriving after them waits for all of them.
+	A failed relock must not leave an exclusive request behind.
+	*/
+	bool RUN = true;
+	if(!RUN) return false;
+	uint32_t NUM_EXCLUSIVE = 3;
+
+	bool ret = true;
+	SharedLock _shared_lock(PreferencePolicy::NONE);
+	std::mutex order_lock;
+	std::vector<uint32_t> order;
+	std::vector<std::thread> threads;
+	_shared_lock.rSharedLock();
+	if(_shared_lock.tryExclusiveLock() == true) ret = false;
+	std::thread other_reader([&] {
+		if(_shared_lock.rTrySharedLock() == false) ret = false;
+		else _shared_lock.rSharedUnlock();
+	});
+	other_reader.join();
+	for(uint32_t index = 0; index <= NUM_EXCLUSIVE; index++) {
+		threads.push_back(std::thread([&, index] {
+			if(index < NUM_EXCLUSIVE) _shared_lock.exclusiveLock();
+			else _shared_lock.rSharedLock();
+			{
+				std::unique_lock<std::mutex> lk(order_lock);
+				order.push_back(index);
+			}
+			usleep(5*1000);
+			if(index < NUM_EXCLUSIVE) _shared_lock.exclusiveUnlock();
+			else _shared_lock.rSharedUnlock();
+		}));
+		usleep(10*1000);
+	}
+	_shared_lock.rSharedUnlock();
+	std::for_each(threads.begin(), threads.end(), [](std::thread& t){t.join();});
+	std::cout<<"\tOrder:";
+	for(uint32_t index = 0; index < order.size(); index++) {
+		std::cout<<" "<<order[index];
+		if(order[index] != index) ret = false;
+	}
+	std::cout<<std::endl;
+	if(order.size() != NUM_EXCLUSIVE + 1) ret = false;
+	return ret;
+};
+
+static thread_local uint32_t test_node = 0;
+
+bool testCohortLock() {
+	/*
+	Two simulated nodes, writers of both nodes queued behind a node 0 writer.
+	On release node 0 writers must be served first through local handoffs.
+	*/
+	bool RUN = true;
+	if(!RUN) return false;
+	uint32_t NUM_WRITERS = 4;
+
+	bool ret = true;
+	CohortSharedLock _cohort_lock(PreferencePolicy::NONE, 2, 2, [] {return test_node;});
+	std::mutex order_lock;
+	std::vector<uint32_t> order;
+	std::vector<std::thread> threads;
+	_cohort_lock.wSharedLock();
+	for(uint32_t index = 0; index < NUM_WRITERS; index++) {
+		threads.push_back(std::thread([&, index] {
+			test_node = index % 2;
+			_cohort_lock.wSharedLock();
+			{
+				std::unique_lock<std::mutex> lk(order_lock);
+				order.push_back(test_node);
+			}
+			usleep(5*1000);
+			_cohort_lock.wSharedUnlock();
+		}));
+		usleep(10*1000);
+	}
+	_cohort_lock.wSharedUnlock();
+	std::for_each(threads.begin(), threads.end(), [](std::thread& t){t.join();});
+	std::cout<<"\tNode order:";
+	std::for_each(order.begin(), order.end(), [](uint32_t node){std::cout<<" "<<node;});
+	std::cout<<" Local handoffs: "<<_cohort_lock.getLocalHandoffs()<<" Global handoffs: "<<_cohort_lock.getGlobalHandoffs()<<std::endl;
+	if(order.size() != NUM_WRITERS || order[0] != 0 || order[1] != 0) ret = false;
+	if(_cohort_lock.getLocalHandoffs() < 2) ret = false;
+	_cohort_lock.rSharedLock();
+	if(_cohort_lock.getNumberReaders(0) != 1 || _cohort_lock.wTrySharedLock() == true) ret = false;
+	_cohort_lock.rSharedUnlock();
+	//Readers and writers of both nodes: a writer is never inside with anybody else
+	std::vector<PreferencePolicy> policies = {PreferencePolicy::NONE, PreferencePolicy::READER, PreferencePolicy::WRITER};
+	for(auto policy: policies) {
+		CohortSharedLock _mixed_lock(policy, 2, 2, [] {return test_node;});
+		std::atomic<int32_t> inside(0);
+		std::atomic<bool> overlap(false);
+		threads.clear();
+		for(uint32_t index = 0; index < 2*NUM_WRITERS; index++) {
+			threads.push_back(std::thread([&, index] {
+				test_node = index % 2;
+				for(uint32_t access = 0; access < 200; access++) {
+					if(index % 4 < 2) {
+						if(!_mixed_lock.wTrySharedLock(1)) continue;
+						if(inside.exchange(-1) != 0) overlap = true;
+						inside = 0;
+						_mixed_lock.wSharedUnlock();
+					} else {
+						_mixed_lock.rSharedLock();
+						if(inside++ < 0) overlap = true;
+						inside--;
+						_mixed_lock.rSharedUnlock();
+					}
+				}
+			}));
+		}
+		std::for_each(threads.begin(), threads.end(), [](std::thread& t){t.join();});
+		if(overlap || _mixed_lock.getNumberReaders() != 0 || _mixed_lock.getNumberWriters() != 0) ret = false;
+	}
+	std::cout<<"\tMixed readers and writers exclusive: "<<ret<<std::endl;
+	return ret;
+};
+
+bool testAdaptivePolicy() {
+	/*
+	Read only traffic must switch ADAPTIVE to READER, write only traffic to WRITER
+	*/
+	bool RUN = true;
+	if(!RUN) return false;
+	uint16_t ACCESS_RETRIES = 300;
+
+	bool ret = true;
+	SharedLock _shared_lock(PreferencePolicy::ADAPTIVE);
+	if(_shared_lock.getAdaptiveMode() != PreferencePolicy::NONE) ret = false;
+	for(uint16_t index = 0; index < ACCESS_RETRIES; index++) {
+		if(_shared_lock.rTrySharedLock(10) == true) _shared_lock.rSharedUnlock();
+	}
+	if(_shared_lock.getAdaptiveMode() != PreferencePolicy::READER) ret = false;
+	std::cout<<"\tAfter reads READER mode: "<<(_shared_lock.getAdaptiveMode() == PreferencePolicy::READER)<<std::endl;
+	for(uint16_t index = 0; index < ACCESS_RETRIES; index++) {
+		if(_shared_lock.wTrySharedLock(10) == true) _shared_lock.wSharedUnlock();
+	}
+	if(_shared_lock.getAdaptiveMode() != PreferencePolicy::WRITER) ret = false;
+	std::cout<<"\tAfter writes WRITER mode: "<<(_shared_lock.getAdaptiveMode() == PreferencePolicy::WRITER)
+		<<" Switches: "<<_shared_lock.getPolicySwitches()<<std::endl;
+	return ret;
+};
+
+bool testCompactLock() {
+	/*
+	One word lock: NONE rules hold and contended writers lose no increments
+	*/
+	bool RUN = true;
+	if(!RUN) return false;
+	uint32_t NUM_THREADS = 4;
+	uint32_t NUM_OPERATIONS = 20000;
+
+	bool ret = true;
+	CompactSharedLock _compact_lock(PreferencePolicy::NONE);
+	std::cout<<"\tsizeof(CompactSharedLock): "<<sizeof(CompactSharedLock)<<" sizeof(SharedLock): "<<sizeof(SharedLock)<<std::endl;
+	_compact_lock.rSharedLock();
+	if(_compact_lock.wTrySharedLock() == true || _compact_lock.tryExclusiveLock(10) == true) ret = false;
+	if(_compact_lock.rTrySharedLock() == false) ret = false;
+	else _compact_lock.rSharedUnlock();
+	_compact_lock.rSharedUnlock();
+	uint32_t counter = 0;
+	std::vector<std::thread> threads;
+	for(uint32_t index = 0; index < NUM_THREADS; index++) {
+		threads.push_back(std::thread([&, index] {
+			for(uint32_t op = 0; op < NUM_OPERATIONS; op++) {
+				if(index == 0) {
+					_compact_lock.exclusiveLock();
+					counter++;
+					_compact_lock.exclusiveUnlock();
+					continue;
+				}
+				_compact_lock.wSharedLock();
+				counter++;
+				_compact_lock.wSharedUnlock();
+			}
+		}));
+	}
+	std::for_each(threads.begin(), threads.end(), [](std::thread& t){t.join();});
+	std::cout<<"\tCounter: "<<counter<<" Expected: "<<NUM_THREADS*NUM_OPERATIONS<<std::endl;
+	if(counter != NUM_THREADS*NUM_OPERATIONS) ret = false;
+	if(_compact_lock.getNumberReaders() != 0 || _compact_lock.getNumberWriters() != 0) ret = false;
+	return ret;
+};
+
+bool testTraceReplay() {
+	/*
+	Record a small mixed workload, save and load it back, replay it on another lock
+	*/
+	bool RUN = true;
+	if(!RUN) return false;
+	uint32_t NUM_THREADS = 4;
+	uint32_t NUM_OPERATIONS = 50;
+	const char* TRACE_FILE = "lock_trace_test.bin";
+
+	bool ret = true;
+	LockTraceRecorder recorder;
+	SharedLock _shared_lock(PreferencePolicy::NONE);
+	_shared_lock.setTraceRecorder(&recorder);
+	std::vector<std::thread> threads;
+	for(uint32_t index = 0; index < NUM_THREADS; index++) {
+		threads.push_back(std::thread([&, index] {
+			for(uint32_t op = 0; op < NUM_OPERATIONS; op++) {
+				if(index == 0) {
+					_shared_lock.wSharedLock();
+					usleep(100);
+					_shared_lock.wSharedUnlock();
+				}
+				else {
+					_shared_lock.rSharedLock();
+					usleep(100);
+					_shared_lock.rSharedUnlock();
+				}
+				usleep(200);
+			}
+		}));
+	}
+	std::for_each(threads.begin(), threads.end(), [](std::thread& t){t.join();});
+	_shared_lock.setTraceRecorder(NULL);
+	std::vector<TraceRecord> records;
+	if(recorder.size() != NUM_THREADS*NUM_OPERATIONS) ret = false;
+	if(!recorder.save(TRACE_FILE) || !LockTraceRecorder::load(TRACE_FILE, records)) ret = false;
+	std::remove(TRACE_FILE);
+	if(records.size() != recorder.size()) ret = false;
+	CompactSharedLock _compact_lock(PreferencePolicy::NONE);
+	ReplayResult result = replayTrace(records, _compact_lock);
+	std::cout<<"\t";
+	result.print(std::cout);
+	if(result.operations != records.size() || result.waits[static_cast<uint8_t>(AccessMode::WRITE)].size() != NUM_OPERATIONS) ret = false;
+	return ret;
+};
+
+bool testSnapshot() {
+	/*
+	A scraper reads snapshots while readers, writers and exclusive threads run,
+	an exclusive holder must never be seen next to readers or writers
+	*/
+	bool RUN = true;
+	if(!RUN) return false;
+	uint32_t NUM_THREADS = 6;
+	uint32_t NUM_OPERATIONS = 200;
+
+	std::atomic<bool> ret(true);
+	SharedLock _shared_lock(PreferencePolicy::NONE);
+	std::atomic<bool> running(true);
+	uint64_t scrapes = 0;
+	std::thread scraper([&] {
+		uint64_t version = 0;
+		while(running) {
+			SharedLockSnapshot snapshot = _shared_lock.snapshot();
+			if(snapshot.exclusive_acquired and (snapshot.readers != 0 or snapshot.writers != 0)) ret = false;
+			if(snapshot.readers < 0 or snapshot.writers < 0 or snapshot.version < version) ret = false;
+			version = snapshot.version;
+			scrapes++;
+		}
+	});
+	std::vector<std::thread> threads;
+	for(uint32_t index = 0; index < NUM_THREADS; index++) {
+		threads.push_back(std::thread([&, index] {
+			for(uint32_t op = 0; op < NUM_OPERATIONS; op++) {
+				switch(index % 3) {
+					case 0:
+						_shared_lock.exclusiveLock();
+						if(_shared_lock.snapshot().exclusive_holder != std::this_thread::get_id()) ret = false;
+						_shared_lock.exclusiveUnlock();
+						break;
+					case 1:
+						_shared_lock.wSharedLock();
+						_shared_lock.wSharedUnlock();
+						break;
+					default:
+						_shared_lock.rSharedLock();
+						_shared_lock.rSharedUnlock();
+				}
+			}
+		}));
+	}
+	std::for_each(threads.begin(), threads.end(), [](std::thread& t){t.join();});
+	running = false;
+	scraper.join();
+	_shared_lock.lockReaders();
+	SharedLockSnapshot snapshot = _shared_lock.snapshot();
+	_shared_lock.unlockReaders();
+	std::cout<<"\tScrapes: "<<scrapes<<" Version: "<<snapshot.version<<std::endl;
+	if(snapshot.readers != 0 or snapshot.writers != 0 or snapshot.future_readers != 0 or snapshot.exclusive_waiters != 0) ret = false;
+	if(snapshot.exclusive_acquired or snapshot.exclusive_holder != std::thread::id()) ret = false;
+	if(!snapshot.locked_readers or snapshot.locked_writers) ret = false;
+	if(_shared_lock.snapshot().locked_readers) ret = false;
+	return ret;
+};
+
+bool testProcessSharedLock() {
+	/*
+	Forked processes update a counter in a shared segment under the lock,
+	then a process dies holding exclusive access and the lock is recovered,
+	even while the dead process is still a zombie
+	*/
+	bool RUN = true;
+	if(!RUN) return false;
+	uint32_t NUM_PROCESSES = 3;
+	uint32_t NUM_OPERATIONS = 200;
+	std::string SEGMENT = "/shared_lock_test_" + std::to_string(getpid());
+
+	bool ret = true;
+	ProcessSharedSegment segment(SEGMENT, sizeof(uint64_t), PreferencePolicy::NONE);
+	ProcessSharedSegment::unlink(SEGMENT);
+	uint64_t* counter = reinterpret_cast<uint64_t*>(segment.getData());
+	std::vector<pid_t> children;
+	for(uint32_t index = 0; index < NUM_PROCESSES; index++) {
+		pid_t pid = fork();
+		if(pid == 0) {
+			ProcessSharedLock _process_lock(segment.getState());
+			for(uint32_t op = 0; op < NUM_OPERATIONS; op++) {
+				_process_lock.wSharedLock();
+				uint64_t value = *counter;
+				usleep(10);
+				*counter = value + 1;
+				_process_lock.wSharedUnlock();
+				_process_lock.rSharedLock();
+				_process_lock.rSharedUnlock();
+			}
+			_exit(0);
+		}
+		children.push_back(pid);
+	}
+	for(auto pid: children) waitpid(pid, NULL, 0);
+	ProcessSharedLock _process_lock(segment.getState());
+	std::cout<<"\tCounter: "<<*counter<<std::endl;
+	if(*counter != NUM_PROCESSES*NUM_OPERATIONS) ret = false;
+	pid_t pid = fork();
+	if(pid == 0) {
+		ProcessSharedLock _dying_lock(segment.getState());
+		_dying_lock.exclusiveLock();
+		_exit(0);
+	}
+	//Not waited for until recovered, the dead holder stays a zombie
+	siginfo_t info;
+	waitid(P_PID, pid, &info, WEXITED | WNOWAIT);
+	if(_process_lock.rTrySharedLock()) ret = false;
+	//Dead holder is found on the next reap interval
+	if(!_process_lock.tryExclusiveLock(2*ProcessSharedLock::REAP_INTERVAL)) ret = false;
+	else _process_lock.exclusiveUnlock();
+	waitpid(pid, NULL, 0);
+	std::cout<<"\tRecoveries: "<<_process_lock.getRecoveries()<<std::endl;
+	if(_process_lock.getRecoveries() != 1 or _process_lock.getNumberReaders() != 0 or _process_lock.getNumberWriters() != 0) ret = false;
+	//Unlocking access not held throws and leaves no slot taken by this process
+	bool thrown = false;
+	try {
+		_process_lock.rSharedUnlock();
+	}
+	catch (std::runtime_error& e) {
+		thrown = true;
+	}
+	ProcessSharedState* state = segment.getState();
+	for(uint32_t index = 0; index < ProcessSharedState::MAX_PROCESSES; index++) {
+		if(state->holders[index].pid == getpid()) thrown = false;
+	}
+	if(!thrown) ret = false;
+	return ret;
+};
+
+bool testCancellableWaits() {
+	/*
+	Blocked readers, writers and exclusive requests are woken by cancelAll,
+	a Reader blocked behind lockReaders stops at once, close refuses new access
+	*/
+	bool RUN = true;
+	if(!RUN) return false;
+
+	std::atomic<bool> ret(true);
+	std::atomic<uint32_t> cancelled(0);
+	SharedLock _shared_lock(PreferencePolicy::NONE);
+	_shared_lock.exclusiveLock();
+	std::vector<std::thread> threads;
+	threads.push_back(std::thread([&] {
+		try {
+			_shared_lock.rSharedLock();
+			ret = false;
+		}
+		catch (LockCancelled& e) {
+			cancelled++;
+		}
+	}));
+	threads.push_back(std::thread([&] {
+		try {
+			_shared_lock.wSharedLock();
+			ret = false;
+		}
+		catch (LockCancelled& e) {
+			cancelled++;
+		}
+	}));
+	threads.push_back(std::thread([&] {
+		CancellationToken token;
+		if(_shared_lock.exclusiveLock(token)) ret = false;
+		else cancelled++;
+	}));
+	usleep(50*1000);
+	_shared_lock.cancelAll();
+	std::for_each(threads.begin(), threads.end(), [](std::thread& t){t.join();});
+	_shared_lock.exclusiveUnlock();
+	std::cout<<"\tCancelled: "<<cancelled<<std::endl;
+	if(cancelled != 3) ret = false;
+	//cancelAll only concerns waiters of that moment
+	_shared_lock.rSharedLock();
+	_shared_lock.rSharedUnlock();
+
+	_shared_lock.lockReaders();
+	Reader reader(&_shared_lock);
+	reader.readContinously();
+	usleep(50*1000);
+	auto start = std::chrono::steady_clock::now();
+	reader.stop();
+	uint64_t elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	_shared_lock.unlockReaders();
+	std::cout<<"\tReader stopped in: "<<elapsed<<" ms"<<std::endl;
+	if(elapsed > 50) ret = false;
+
+	//A cancelled exclusive request lets the async reader queued behind it in
+	_shared_lock.rSharedLock();
+	CancellationToken exclusive_token;
+	std::thread exclusive([&] {
+		if(_shared_lock.exclusiveLock(exclusive_token)) ret = false;
+	});
+	usleep(20*1000);
+	std::atomic<bool> granted(false);
+	_shared_lock.asyncRSharedLock([&] {granted = true;});
+	exclusive_token.cancel();
+	exclusive.join();
+	if(!granted or _shared_lock.getNumberReaders() != 2) ret = false;
+	_shared_lock.rSharedUnlock();
+	_shared_lock.rSharedUnlock();
+
+	CancellationToken token;
+	token.cancel();
+	if(_shared_lock.wSharedLock(token)) ret = false;
+	//Async requests still queued at close fail instead of hanging
+	_shared_lock.exclusiveLock();
+	std::future<void> read_future = _shared_lock.rSharedLockFuture();
+	std::future<void> exclusive_future = _shared_lock.exclusiveLockFuture();
+	_shared_lock.close();
+	for(auto future: {&read_future, &exclusive_future}) {
+		try {
+			future->get();
+			ret = false;
+		}
+		catch (LockCancelled& e) {
+		}
+	}
+	_shared_lock.exclusiveUnlock();
+	if(_shared_lock.getNumberReaders() != 0 or _shared_lock.getNumberWriters() != 0) ret = false;
+	if(!_shared_lock.isClosed() or _shared_lock.rTrySharedLock() or _shared_lock.tryExclusiveLock(10)) ret = false;
+	try {
+		_shared_lock.wSharedLock();
+		ret = false;
+	}
+	catch (LockCancelled& e) {
+	}
+	return ret;
+};
+
+bool testReentrantLock() {
+	/*
+	Nested acquisitions on a reentrant lock only count per thread, the lock
+	is released by the outermost unlock. Upgrades and non reentrant locks still refuse
+	*/
+	bool RUN = true;
+	if(!RUN) return false;
+	uint32_t DEPTH = 3;
+
+	bool ret = true;
+	SharedLock _shared_lock(PreferencePolicy::NONE, true);
+	for(uint32_t depth = 0; depth < DEPTH; depth++) _shared_lock.rSharedLock();
+	if(!_shared_lock.rTrySharedLock() or _shared_lock.getNumberReaders() != 1) ret = false;
+	_shared_lock.rSharedUnlock();
+	std::thread writer([&] {
+		if(_shared_lock.wTrySharedLock()) ret = false;
+	});
+	writer.join();
+	for(uint32_t depth = 0; depth < DEPTH; depth++) _shared_lock.rSharedUnlock();
+	if(_shared_lock.getNumberReaders() != 0) ret = false;
+
+	//Exclusive covers write and read, read does not upgrade
+	_shared_lock.exclusiveLock();
+	_shared_lock.wSharedLock();
+	_shared_lock.rSharedLock();
+	if(!_shared_lock.tryExclusiveLock() or _shared_lock.getNumberWriters() != 0) ret = false;
+	_shared_lock.exclusiveUnlock();
+	_shared_lock.rSharedUnlock();
+	_shared_lock.wSharedUnlock();
+	_shared_lock.exclusiveUnlock();
+	//The outermost unlock releases the mode held, not the one it names
+	_shared_lock.exclusiveLock();
+	_shared_lock.rSharedLock();
+	_shared_lock.exclusiveUnlock();
+	_shared_lock.rSharedUnlock();
+	if(_shared_lock.getNumberReaders() != 0 or _shared_lock.snapshot().exclusive_acquired) ret = false;
+	_shared_lock.rSharedLock();
+	if(_shared_lock.wTrySharedLock()) ret = false;
+	try {
+		_shared_lock.wSharedLock();
+		ret = false;
+	}
+	catch (std::runtime_error& e) {
+	}
+	_shared_lock.rSharedUnlock();
+	SharedLockSnapshot snapshot = _shared_lock.snapshot();
+	std::cout<<"\tReaders: "<<snapshot.readers<<" Writers: "<<snapshot.writers<<" Exclusive: "<<snapshot.exclusive_acquired<<std::endl;
+	if(snapshot.readers != 0 or snapshot.writers != 0 or snapshot.exclusive_acquired) ret = false;
+
+	SharedLock _plain_lock(PreferencePolicy::NONE);
+	_plain_lock.rSharedLock();
+	if(_plain_lock.rTrySharedLock()) ret = false;
+	_plain_lock.rSharedUnlock();
+	return ret;
+};
+
+bool testSegmentedMemory() {
+	/*
+	Appends spill over several segments without moving written bytes,
+	views are walked segment by segment. A bounded space drops what does not fit
+	*/
+	bool RUN = true;
+	if(!RUN) return false;
+	size_t WRITE_SIZE = 10000;
+	size_t TOTAL_SIZE = 3*MemorySpace::SEGMENT_SIZE + 100;
+
+	bool ret = true;
+	MemorySpace memory;
+	std::vector<uint8_t> buffer(WRITE_SIZE);
+	for(size_t written = 0; written < TOTAL_SIZE;) {
+		size_t size = std::min(WRITE_SIZE, TOTAL_SIZE - written);
+		for(size_t index = 0; index < size; index++) buffer[index] = (written + index) % 251;
+		if(memory.write(buffer.data(), size) != size) ret = false;
+		written += size;
+	}
+	const uint8_t* first = memory.view().data;
+	memory.write(buffer.data(), WRITE_SIZE);
+	if(memory.view().data != first or memory.view().size != MemorySpace::SEGMENT_SIZE) ret = false;
+	uint32_t cursor = memory.openCursor();
+	size_t read = 0;
+	uint32_t views = 0;
+	for(MemoryView view = memory.readNew(cursor); view.size > 0; view = memory.readNew(cursor)) {
+		if(view.offset != read) ret = false;
+		for(size_t index = 0; index < view.size and view.offset + index < TOTAL_SIZE; index++) {
+			if(view.data[index] != (view.offset + index) % 251) ret = false;
+		}
+		read += view.size;
+		views++;
+	}
+	std::cout<<"\tSize: "<<memory.getSize()<<" Segments: "<<memory.getNumberSegments()<<" Views: "<<views<<std::endl;
+	if(read != TOTAL_SIZE + WRITE_SIZE or views != memory.getNumberSegments() or views != 4) ret = false;
+	//read() copies the tail across segments, more than was written gives nothing
+	std::vector<uint8_t> tail(WRITE_SIZE + 200);
+	if(memory.read(tail.data(), tail.size()) != tail.size()) ret = false;
+	for(size_t index = 0; index < tail.size(); index++) {
+		uint8_t expected = (index < 200) ? (TOTAL_SIZE - 200 + index) % 251 : buffer[index - 200];
+		if(tail[index] != expected) ret = false;
+	}
+	if(memory.read(tail.data(), memory.getSize() + 1) != 0) ret = false;
+	memory.restartMemory();
+	if(memory.getNumberSegments() != 0 or memory.getSize() != 0) ret = false;
+
+	MemorySpace bounded(64);
+	if(bounded.write(buffer.data(), 60) != 60 or bounded.write(buffer.data(), 10) != 0 or bounded.getSize() != 60) ret = false;
+	return ret;
+};
+
+bool testShardedMemory() {
+	/*
+	Writers keyed to their own shard run in parallel, sequential and parallel
+	scans see the same bytes and merge per shard counts, also when parallel
+	scans overlap
+	*/
+	bool RUN = true;
+	if(!RUN) return false;
+	uint32_t NUM_SHARDS = 4;
+	uint32_t NUM_WRITERS = 8;
+	uint32_t NUM_WRITES = 10;
+	size_t WRITE_SIZE = 100;
+
+	std::atomic<bool> ret(true);
+	ShardedMemorySpace memory(NUM_SHARDS, PreferencePolicy::NONE);
+	uint32_t cursor = memory.openCursor();
+	std::vector<size_t> expected(NUM_SHARDS, 0);
+	std::vector<std::thread> threads;
+	for(uint32_t key = 0; key < NUM_WRITERS; key++) {
+		expected[memory.getShard(key)] += NUM_WRITES*WRITE_SIZE;
+		threads.push_back(std::thread([&, key] {
+			std::vector<uint8_t> buffer(WRITE_SIZE, (uint8_t) key);
+			for(uint32_t write = 0; write < NUM_WRITES; write++) {
+				if(memory.write(key, buffer.data(), WRITE_SIZE) != WRITE_SIZE) ret = false;
+			}
+		}));
+	}
+	std::for_each(threads.begin(), threads.end(), [](std::thread& t){t.join();});
+	std::vector<std::atomic<size_t>> per_shard(NUM_SHARDS);
+	for(auto& shard_size: per_shard) shard_size = 0;
+	size_t scanned = memory.scan(cursor, [&](uint32_t shard, const MemoryView& view) {
+		for(size_t index = 0; index < view.size; index++) {
+			if(memory.getShard(view.data[index]) != shard) ret = false;
+		}
+		per_shard[shard] += view.size;
+	}, true);
+	for(uint32_t shard = 0; shard < NUM_SHARDS; shard++) {
+		if(per_shard[shard] != expected[shard]) ret = false;
+	}
+	std::cout<<"\tScanned: "<<scanned<<" Size: "<<memory.getSize()<<std::endl;
+	if(scanned != NUM_WRITERS*NUM_WRITES*WRITE_SIZE or scanned != memory.getSize()) ret = false;
+	//Nothing new for this cursor, a fresh one sees everything again
+	if(memory.scan(cursor, [](uint32_t, const MemoryView&) {}, false) != 0) ret = false;
+	uint32_t other = memory.openCursor();
+	if(memory.scan(other, [](uint32_t, const MemoryView&) {}, false) != scanned) ret = false;
+	memory.closeCursor(cursor);
+	memory.closeCursor(other);
+	//Concurrent parallel scans take turns on the same workers
+	std::atomic<size_t> rescanned(0);
+	threads.clear();
+	for(uint32_t index = 0; index < 2; index++) {
+		threads.push_back(std::thread([&] {
+			uint32_t own = memory.openCursor();
+			for(uint32_t round = 0; round < 3; round++) rescanned += memory.scan(own, [](uint32_t, const MemoryView&) {}, true);
+			memory.closeCursor(own);
+		}));
+	}
+	std::for_each(threads.begin(), threads.end(), [](std::thread& t){t.join();});
+	if(rescanned != 2*scanned) ret = false;
+	//A throwing visitor reaches the caller, shards are unlocked and the workers free again
+	uint32_t failing = memory.openCursor();
+	try {
+		memory.scan(failing, [](uint32_t, const MemoryView&) {throw std::runtime_error("Visitor failed");}, true);
+		ret = false;
+	}
+	catch (std::runtime_error& e) {
+	}
+	for(uint32_t shard = 0; shard < NUM_SHARDS; shard++) {
+		if(!memory.getLock(shard)->wTrySharedLock()) ret = false;
+		else memory.getLock(shard)->wSharedUnlock();
+	}
+	uint32_t after = memory.openCursor();
+	if(memory.scan(after, [](uint32_t, const MemoryView&) {}, true) != scanned) ret = false;
+	memory.closeCursor(failing);
+	memory.closeCursor(after);
+	return ret;
+};
+
+bool testLockWatchdog() {
+	/*
+	A writer holds the lock past the hold budget while a reader waits past the
+	wait budget, the watchdog reports each of them once
+	*/
+	bool RUN = true;
+	if(!RUN) return false;
+	uint32_t BUDGET = 50;
+	uint32_t HOLD = 200;
+
+	bool ret = true;
+	SharedLock _shared_lock(PreferencePolicy::NONE);
+	std::mutex reports_lock;
+	std::vector<LockWatchdogReport> reports;
+	LockWatchdog watchdog(BUDGET, BUDGET, 10, [&](const LockWatchdogReport& report) {
+		std::unique_lock<std::mutex> lk(reports_lock);
+		reports.push_back(report);
+	});
+	watchdog.watch(&_shared_lock, "test");
+	watchdog.start();
+	std::thread::id writer_id;
+	std::thread::id reader_id;
+	std::thread writer([&] {
+		_shared_lock.wSharedLock();
+		usleep(HOLD*1000);
+		_shared_lock.wSharedUnlock();
+	});
+	usleep(10*1000);
+	std::thread reader([&] {
+		_shared_lock.rSharedLock();
+		_shared_lock.rSharedUnlock();
+	});
+	writer_id = writer.get_id();
+	reader_id = reader.get_id();
+	writer.join();
+	reader.join();
+	usleep(50*1000);
+	watchdog.stop();
+	for(auto& report: reports) {
+		std::cout<<"\t"<<report.name<<(report.waiting ? " waiter " : " holder ")<<static_cast<int>(report.mode)<<" for "<<report.duration<<" ms"<<std::endl;
+		if(report.duration < BUDGET or report.name != "test") ret = false;
+		if(report.waiting and (report.thread != reader_id or report.mode != AccessMode::READ)) ret = false;
+		if(!report.waiting and (report.thread != writer_id or report.mode != AccessMode::WRITE)) ret = false;
+	}
+	if(reports.size() != 2 or watchdog.getReports() != 2 or !_shared_lock.getActivity().empty()) ret = false;
+	//One thread on two tracked locks has a slot in each, disabling tracking clears them
+	SharedLock _other_lock(PreferencePolicy::NONE);
+	_other_lock.setActivityTracking(true);
+	_shared_lock.rSharedLock();
+	_other_lock.rSharedLock();
+	if(_shared_lock.getActivity().size() != 1 or _other_lock.getActivity().size() != 1) ret = false;
+	_other_lock.setActivityTracking(false);
+	if(!_other_lock.getActivity().empty()) ret = false;
+	_other_lock.rSharedUnlock();
+	_shared_lock.rSharedUnlock();
+	if(!_shared_lock.getActivity().empty()) ret = false;
+	return ret;
+};
+
+/*
+Same checks for every implementation of the SharedLock API: exclusive and
+write access exclude everybody, readers share, tries time out
+*/
+template <class Lock>
+bool checkLockBackend(Lock& lock) {
+	uint32_t NUM_THREADS = 4;
+	uint32_t NUM_OPERATIONS = 200;
+
+	std::atomic<bool> ret(true);
+	uint64_t counter = 0;
+	std::vector<std::thread> threads;
+	for(uint32_t index = 0; index < NUM_THREADS; index++) {
+		threads.push_back(std::thread([&, index] {
+			for(uint32_t op = 0; op < NUM_OPERATIONS; op++) {
+				if(index % 2 == 0) lock.exclusiveLock();
+				else lock.wSharedLock();
+				uint64_t value = counter;
+				std::this_thread::yield();
+				counter = value + 1;
+				if(index % 2 == 0) lock.exclusiveUnlock();
+				else lock.wSharedUnlock();
+				lock.rSharedLock();
+				lock.rSharedUnlock();
+			}
+		}));
+	}
+	std::for_each(threads.begin(), threads.end(), [](std::thread& t){t.join();});
+	if(counter != NUM_THREADS*NUM_OPERATIONS) ret = false;
+	lock.rSharedLock();
+	std::thread other([&] {
+		if(!lock.rTrySharedLock()) ret = false;
+		else lock.rSharedUnlock();
+		if(lock.wTrySharedLock(10) or lock.tryExclusiveLock()) ret = false;
+	});
+	other.join();
+	if(lock.getNumberReaders() != 1 or lock.getNumberWriters() != 0) ret = false;
+	lock.rSharedUnlock();
+	lock.wSharedLock();
+	std::thread reader([&] {
+		if(lock.rTrySharedLock(10)) ret = false;
+	});
+	reader.join();
+	lock.wSharedUnlock();
+	return ret;
+};
+
+bool testLockBackends() {
+	/*
+	SharedLock, the pthread_rwlock and std::shared_mutex backends and the one
+	selected at compile time pass the same checks
+	*/
+	bool RUN = true;
+	if(!RUN) return false;
+
+	bool ret = true;
+	SharedLock _shared_lock(PreferencePolicy::NONE);
+	ret = checkLockBackend(_shared_lock) and ret;
+	RWLockSharedLock _rwlock(PreferencePolicy::WRITER);
+	ret = checkLockBackend(_rwlock) and ret;
+	std::cout<<"\tSharedLock and pthread_rwlock: "<<ret<<std::endl;
+#ifdef SHARED_LOCK_STD_BACKEND
+	StdSharedLock _std_lock(PreferencePolicy::NONE);
+	ret = checkLockBackend(_std_lock) and ret;
+	std::cout<<"\tstd::shared_mutex: "<<ret<<std::endl;
+#endif
+	BackendSharedLock _backend_lock(PreferencePolicy::NONE);
+	ret = checkLockBackend(_backend_lock) and ret;
+	return ret;
+};
+
 int main() {
 
 	bool passed;
 	std::vector<std::pair<const std::string, bool>> result;
 
 
+	std::cout<<"Launching Test Memory View: "<<std::endl;
+	passed = testMemoryView();
+	result.push_back({"testMemoryView", passed});
+
+	std::cout<<"Launching Test Memory Cursors: "<<std::endl;
+	passed = testMemoryCursors();
+	result.push_back({"testMemoryCursors", passed});
+
+	std::cout<<"Launching Test Wait For Data: "<<std::endl;
+	passed = testWaitForData();
+	result.push_back({"testWaitForData", passed});
+
+	std::cout<<"Launching Test Batching Writer: "<<std::endl;
+	passed = testBatchingWriter();
+	result.push_back({"testBatchingWriter", passed});
+
+	std::cout<<"Launching Test Flat Combining: "<<std::endl;
+	passed = testFlatCombining();
+	result.push_back({"testFlatCombining", passed});
+
+	std::cout<<"Launching Test Async Acquisition: "<<std::endl;
+	passed = testAsyncAcquisition();
+	result.push_back({"testAsyncAcquisition", passed});
+
+	std::cout<<"Launching Test Workload Driver: "<<std::endl;
+	passed = testWorkloadDriver();
+	result.push_back({"testWorkloadDriver", passed});
+
+	std::cout<<"Launching Test Writer Aging: "<<std::endl;
+	passed = testWriterAging();
+	result.push_back({"testWriterAging", passed});
+
+	std::cout<<"Launching Test Priority Admission: "<<std::endl;
+	passed = testPriorityAdmission();
+	result.push_back({"testPriorityAdmission", passed});
+
+	std::cout<<"Launching Test Exclusive Queue: "<<std::endl;
+	passed = testExclusiveQueue();
+	result.push_back({"testExclusiveQueue", passed});
+
+	std::cout<<"Launching Test Cohort Lock: "<<std::endl;
+	passed = testCohortLock();
+	result.push_back({"testCohortLock", passed});
+
+	std::cout<<"Launching Test Adaptive Policy: "<<std::endl;
+	passed = testAdaptivePolicy();
+	result.push_back({"testAdaptivePolicy", passed});
+
+	std::cout<<"Launching Test Compact Lock: "<<std::endl;
+	passed = testCompactLock();
+	result.push_back({"testCompactLock", passed});
+
+	std::cout<<"Launching Test Trace Replay: "<<std::endl;
+	passed = testTraceReplay();
+	result.push_back({"testTraceReplay", passed});
+
+	std::cout<<"Launching Test Snapshot: "<<std::endl;
+	passed = testSnapshot();
+	result.push_back({"testSnapshot", passed});
+
+	std::cout<<"Launching Test Process Shared Lock: "<<std::endl;
+	passed = testProcessSharedLock();
+	result.push_back({"testProcessSharedLock", passed});
+
+	std::cout<<"Launching Test Cancellable Waits: "<<std::endl;
+	passed = testCancellableWaits();
+	result.push_back({"testCancellableWaits", passed});
+
+	std::cout<<"Launching Test Reentrant Lock: "<<std::endl;
+	passed = testReentrantLock();
+	result.push_back({"testReentrantLock", passed});
+
+	std::cout<<"Launching Test Segmented Memory: "<<std::endl;
+	passed = testSegmentedMemory();
+	result.push_back({"testSegmentedMemory", passed});
+
+	std::cout<<"Launching Test Sharded Memory: "<<std::endl;
+	passed = testShardedMemory();
+	result.push_back({"testShardedMemory", passed});
+
+	std::cout<<"Launching Test Lock Watchdog: "<<std::endl;
+	passed = testLockWatchdog();
+	result.push_back({"testLockWatchdog", passed});
+
+	std::cout<<"Launching Test Lock Backends: "<<std::endl;
+	passed = testLockBackends();
+	result.push_back({"testLockBackends", passed});
+
 	std::cout<<"Launching Test Future Readers Block Writers: "<<std::endl;
 	passed = testFutureReadersBlocksWriter();
 	result.push_back({"testFutureReadersBlocksWriter", passed});
@@ -0,0 +1,402 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <type_traits>
+#include <unistd.h>
+
+#include "process_lock.hpp"
+
+using namespace std::chrono;
+
+static_assert(std::is_trivial<ProcessSharedState>::value and std::is_standard_layout<ProcessSharedState>::value, "ProcessSharedState must be plain data to live in shared memory");
+
+const uint32_t ProcessSharedState::MAX_PROCESSES;
+const uint32_t ProcessSharedLock::MAGIC = 0x53484C50;
+const uint16_t ProcessSharedLock::REAP_INTERVAL = 100;
+//State rounded up to a cache line, data starts there
+const size_t ProcessSharedSegment::DATA_OFFSET = (sizeof(ProcessSharedState) + 63) & ~((size_t) 63);
+
+ProcessSharedState* ProcessSharedLock::initialize(void* region, PreferencePolicy policy){
+	if(policy != PreferencePolicy::READER and policy != PreferencePolicy::WRITER and policy != PreferencePolicy::NONE) throw std::runtime_error("Policy not supported by process shared lock");
+	ProcessSharedState* state = static_cast<ProcessSharedState*>(region);
+	memset(state, 0, sizeof(ProcessSharedState));
+	state->policy = static_cast<uint32_t>(policy);
+	pthread_mutexattr_t mutex_attr;
+	pthread_mutexattr_init(&mutex_attr);
+	pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&mutex_attr, PTHREAD_MUTEX_ROBUST);
+	int ret = pthread_mutex_init(&state->mutex, &mutex_attr);
+	pthread_mutexattr_destroy(&mutex_attr);
+	if(ret != 0) throw std::runtime_error("Unable to create process shared mutex");
+	pthread_condattr_t cond_attr;
+	pthread_condattr_init(&cond_attr);
+	pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+	pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+	ret = pthread_cond_init(&state->cv, &cond_attr);
+	pthread_condattr_destroy(&cond_attr);
+	if(ret != 0) throw std::runtime_error("Unable to create process shared condition");
+	//Published last, attaching processes check it
+	__atomic_store_n(&state->magic, ProcessSharedLock::MAGIC, __ATOMIC_RELEASE);
+	return state;
+};
+
+ProcessSharedLock::ProcessSharedLock(ProcessSharedState* state): _state(state){
+	if(state == NULL or __atomic_load_n(&state->magic, __ATOMIC_ACQUIRE) != ProcessSharedLock::MAGIC) throw std::runtime_error("Process shared lock not initialized");
+};
+
+/*
+A previous owner died holding the mutex: counters may be half updated,
+drop the dead processes and rebuild them from the holder slots.
+*/
+void ProcessSharedLock::_lockState() const {
+	ProcessSharedLock* self = const_cast<ProcessSharedLock*>(this);
+	int ret = pthread_mutex_lock(&_state->mutex);
+	if(ret == EOWNERDEAD) {
+		self->_reap();
+		self->_recount();
+		pthread_mutex_consistent(&_state->mutex);
+		pthread_cond_broadcast(&_state->cv);
+	}
+	else if(ret != 0) throw std::runtime_error("Unable to lock process shared mutex");
+};
+
+void ProcessSharedLock::_unlockState() const {
+	pthread_mutex_unlock(&_state->mutex);
+};
+
+//Slot of the calling process, NULL when it holds and awaits nothing
+ProcessHolder* ProcessSharedLock::_findHolder() const {
+	pid_t pid = getpid();
+	for(uint32_t index = 0; index < ProcessSharedState::MAX_PROCESSES; index++) {
+		if(_state->holders[index].pid == pid) return &_state->holders[index];
+	}
+	return NULL;
+};
+
+//Slot of the calling process, taken on first use
+ProcessHolder* ProcessSharedLock::_holder(){
+	pid_t pid = getpid();
+	ProcessHolder* free_slot = NULL;
+	for(uint32_t index = 0; index < ProcessSharedState::MAX_PROCESSES; index++) {
+		ProcessHolder* holder = &_state->holders[index];
+		if(holder->pid == pid) return holder;
+		if(holder->pid == 0 and free_slot == NULL) free_slot = holder;
+	}
+	if(free_slot == NULL and _reap()) return _holder();
+	if(free_slot == NULL) throw std::runtime_error("Too many processes on process shared lock");
+	free_slot->pid = pid;
+	return free_slot;
+};
+
+/*Same rules as CompactSharedLock*/
+bool ProcessSharedLock::_admissible(AccessMode mode) const {
+	PreferencePolicy policy = static_cast<PreferencePolicy>(_state->policy);
+	if(mode == AccessMode::EXCLUSIVE) return (_state->exclusive == 0 and _state->readers == 0 and _state->writers == 0);
+	if(_state->exclusive > 0 or _state->waiting_exclusive > 0) return false;
+	if(mode == AccessMode::READ) {
+		if(policy == PreferencePolicy::NONE) return (_state->writers == 0);
+		if(policy == PreferencePolicy::WRITER) return !(_state->readers > 0 and _state->writers > 0);
+		return true;
+	}
+	if(policy == PreferencePolicy::NONE) return (_state->writers == 0 and _state->readers == 0);
+	if(policy == PreferencePolicy::READER) return (_state->readers == 0 and _state->waiting_readers == 0);
+	return true;
+};
+
+/*
+Waits on the shared condition with REAP_INTERVAL wake ups, a holder that
+died without releasing never notifies us.
+*/
+bool ProcessSharedLock::_acquire(AccessMode mode, bool timed, steady_clock::time_point deadline){
+	_lockState();
+	auto resolve = [this]() -> ProcessHolder* {
+		try {
+			return this->_holder();
+		}
+		catch (...) {
+			this->_unlockState();
+			throw;
+		}
+	};
+	//Try readers are not counted as waiting, same as SharedLock future readers
+	bool announce = !(timed and mode == AccessMode::READ);
+	/*
+	Only an announced waiter keeps the slot of its process in use, an
+	unannounced one takes it once admitted: meanwhile a sibling thread may
+	free it and another process reuse it.
+	*/
+	ProcessHolder* holder = announce ? resolve() : NULL;
+	uint32_t* waiting = NULL;
+	int32_t* total_waiting = (mode == AccessMode::READ) ? &_state->waiting_readers : (mode == AccessMode::WRITE) ? &_state->waiting_writers : &_state->waiting_exclusive;
+	if(announce) waiting = (mode == AccessMode::READ) ? &holder->waiting_readers : (mode == AccessMode::WRITE) ? &holder->waiting_writers : &holder->waiting_exclusive;
+	bool announced = false;
+	bool ret = true;
+	while(!_admissible(mode)) {
+		steady_clock::time_point now = steady_clock::now();
+		if(timed and now >= deadline) {
+			ret = false;
+			break;
+		}
+		if(announce and !announced) {
+			(*waiting)++;
+			(*total_waiting)++;
+			announced = true;
+		}
+		steady_clock::time_point wake_up = now + milliseconds(ProcessSharedLock::REAP_INTERVAL);
+		if(timed) wake_up = std::min(wake_up, deadline);
+		//steady_clock is CLOCK_MONOTONIC on Linux, as set on the condition
+		nanoseconds until = wake_up.time_since_epoch();
+		struct timespec ts;
+		ts.tv_sec = duration_cast<seconds>(until).count();
+		ts.tv_nsec = (until - seconds(ts.tv_sec)).count();
+		int wait = pthread_cond_timedwait(&_state->cv, &_state->mutex, &ts);
+		if(wait == EOWNERDEAD) {
+			_reap();
+			_recount();
+			pthread_mutex_consistent(&_state->mutex);
+			pthread_cond_broadcast(&_state->cv);
+		}
+		else if(wait == ETIMEDOUT and _reap()) pthread_cond_broadcast(&_state->cv);
+	}
+	if(announced) {
+		(*waiting)--;
+		(*total_waiting)--;
+	}
+	if(ret and holder == NULL) holder = resolve();
+	if(ret) {
+		switch(mode) {
+			case AccessMode::READ: holder->readers++; _state->readers++; break;
+			case AccessMode::WRITE: holder->writers++; _state->writers++; break;
+			default: holder->exclusive++; _state->exclusive++;
+		}
+	}
+	//Readers and writers held back by our announcement may go now
+	else if(announced and mode != AccessMode::READ) pthread_cond_broadcast(&_state->cv);
+	if(holder != NULL and holder->readers + holder->writers + holder->exclusive + holder->waiting_readers + holder->waiting_writers + holder->waiting_exclusive == 0) holder->pid = 0;
+	_unlockState();
+	return ret;
+};
+
+void ProcessSharedLock::_release(AccessMode mode){
+	_lockState();
+	ProcessHolder* holder = _findHolder();
+	uint32_t* held = (holder == NULL) ? NULL : (mode == AccessMode::READ) ? &holder->readers : (mode == AccessMode::WRITE) ? &holder->writers : &holder->exclusive;
+	if(held == NULL or *held == 0) {
+		_unlockState();
+		throw std::runtime_error("Unlocking access not held by this process");
+	}
+	(*held)--;
+	switch(mode) {
+		case AccessMode::READ: _state->readers--; break;
+		case AccessMode::WRITE: _state->writers--; break;
+		default: _state->exclusive--;
+	}
+	if(holder->readers + holder->writers + holder->exclusive + holder->waiting_readers + holder->waiting_writers + holder->waiting_exclusive == 0) holder->pid = 0;
+	pthread_cond_broadcast(&_state->cv);
+	_unlockState();
+};
+
+/*
+kill(pid, 0) also succeeds for a zombie, dead but not waited for by its
+parent yet, so on Linux the state in /proc/<pid>/stat is checked as well.
+*/
+static bool process_alive(pid_t pid) {
+	if(kill(pid, 0) != 0 and errno == ESRCH) return false;
+#ifdef __linux__
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) return (errno != ENOENT);
+	char buffer[512];
+	ssize_t size = read(fd, buffer, sizeof(buffer) - 1);
+	close(fd);
+	if(size <= 0) return true;
+	buffer[size] = '\0';
+	//Command name may hold spaces and parentheses, state follows the last ')'
+	char* name_end = strrchr(buffer, ')');
+	if(name_end == NULL or name_end[1] != ' ') return true;
+	return (name_end[2] != 'Z' and name_end[2] != 'X');
+#else
+	return true;
+#endif
+};
+
+/*
+Frees the slots of processes that no longer exist and takes their access
+and waits off the counters. Must be called with the state mutex held.
+*/
+bool ProcessSharedLock::_reap(){
+	bool reaped = false;
+	for(uint32_t index = 0; index < ProcessSharedState::MAX_PROCESSES; index++) {
+		ProcessHolder* holder = &_state->holders[index];
+		if(holder->pid == 0 or holder->pid == getpid()) continue;
+		if(process_alive(holder->pid)) continue;
+		_state->readers -= holder->readers;
+		_state->writers -= holder->writers;
+		_state->exclusive -= holder->exclusive;
+		_state->waiting_readers -= holder->waiting_readers;
+		_state->waiting_writers -= holder->waiting_writers;
+		_state->waiting_exclusive -= holder->waiting_exclusive;
+		memset(holder, 0, sizeof(ProcessHolder));
+		_state->recoveries++;
+		reaped = true;
+	}
+	return reaped;
+};
+
+//Counters from the holder slots, after a process died inside the mutex
+void ProcessSharedLock::_recount(){
+	ProcessSharedState* state = _state;
+	state->readers = state->writers = state->exclusive = 0;
+	state->waiting_readers = state->waiting_writers = state->waiting_exclusive = 0;
+	for(uint32_t index = 0; index < ProcessSharedState::MAX_PROCESSES; index++) {
+		ProcessHolder* holder = &state->holders[index];
+		state->readers += holder->readers;
+		state->writers += holder->writers;
+		state->exclusive += holder->exclusive;
+		state->waiting_readers += holder->waiting_readers;
+		state->waiting_writers += holder->waiting_writers;
+		state->waiting_exclusive += holder->waiting_exclusive;
+	}
+};
+
+void ProcessSharedLock::exclusiveLock(){
+	_acquire(AccessMode::EXCLUSIVE, false, steady_clock::time_point::max());
+};
+
+bool ProcessSharedLock::tryExclusiveLock(){
+	return this->tryExclusiveLock(0);
+};
+
+bool ProcessSharedLock::tryExclusiveLock(uint16_t timeout){
+	return _acquire(AccessMode::EXCLUSIVE, true, steady_clock::now() + milliseconds(timeout));
+};
+
+void ProcessSharedLock::exclusiveUnlock(){
+	_release(AccessMode::EXCLUSIVE);
+};
+
+void ProcessSharedLock::rSharedLock(){
+	_acquire(AccessMode::READ, false, steady_clock::time_point::max());
+};
+
+bool ProcessSharedLock::rTrySharedLock(){
+	return this->rTrySharedLock(0);
+};
+
+bool ProcessSharedLock::rTrySharedLock(uint16_t timeout){
+	return _acquire(AccessMode::READ, true, steady_clock::now() + milliseconds(timeout));
+};
+
+void ProcessSharedLock::rSharedUnlock(){
+	_release(AccessMode::READ);
+};
+
+void ProcessSharedLock::wSharedLock(){
+	_acquire(AccessMode::WRITE, false, steady_clock::time_point::max());
+};
+
+bool ProcessSharedLock::wTrySharedLock(){
+	return this->wTrySharedLock(0);
+};
+
+bool ProcessSharedLock::wTrySharedLock(uint16_t timeout){
+	return _acquire(AccessMode::WRITE, true, steady_clock::now() + milliseconds(timeout));
+};
+
+void ProcessSharedLock::wSharedUnlock(){
+	_release(AccessMode::WRITE);
+};
+
+int32_t ProcessSharedLock::getNumberWriters() const{
+	_lockState();
+	int32_t writers = _state->writers;
+	_unlockState();
+	return writers;
+};
+
+int32_t ProcessSharedLock::getNumberReaders() const{
+	_lockState();
+	int32_t readers = _state->readers;
+	_unlockState();
+	return readers;
+};
+
+int32_t ProcessSharedLock::getNumberFutureReaders() const{
+	_lockState();
+	int32_t waiting_readers = _state->waiting_readers;
+	_unlockState();
+	return waiting_readers;
+};
+
+uint64_t ProcessSharedLock::getRecoveries() const{
+	_lockState();
+	uint64_t recoveries = _state->recoveries;
+	_unlockState();
+	return recoveries;
+};
+
+ProcessSharedSegment::ProcessSharedSegment(const std::string& name, size_t data_size, PreferencePolicy policy): _region(NULL), _size(0){
+	int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+	if(fd < 0) throw std::runtime_error("Unable to create shared segment " + name);
+	size_t size = ProcessSharedSegment::DATA_OFFSET + data_size;
+	if(ftruncate(fd, size) != 0) {
+		close(fd);
+		shm_unlink(name.c_str());
+		throw std::runtime_error("Unable to size shared segment " + name);
+	}
+	_map(fd, size);
+	try {
+		ProcessSharedLock::initialize(_region, policy);
+	}
+	catch (...) {
+		munmap(_region, _size);
+		shm_unlink(name.c_str());
+		throw;
+	}
+};
+
+ProcessSharedSegment::ProcessSharedSegment(const std::string& name): _region(NULL), _size(0){
+	int fd = shm_open(name.c_str(), O_RDWR, 0600);
+	if(fd < 0) throw std::runtime_error("Unable to open shared segment " + name);
+	struct stat info;
+	if(fstat(fd, &info) != 0 or (size_t) info.st_size < ProcessSharedSegment::DATA_OFFSET) {
+		close(fd);
+		throw std::runtime_error("Not a process shared segment " + name);
+	}
+	_map(fd, info.st_size);
+};
+
+ProcessSharedSegment::~ProcessSharedSegment(){
+	if(_region != NULL) munmap(_region, _size);
+};
+
+void ProcessSharedSegment::_map(int fd, size_t size){
+	void* region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(region == MAP_FAILED) throw std::runtime_error("Unable to map shared segment");
+	_region = region;
+	_size = size;
+};
+
+ProcessSharedState* ProcessSharedSegment::getState() const {
+	return static_cast<ProcessSharedState*>(_region);
+};
+
+uint8_t* ProcessSharedSegment::getData() const {
+	return static_cast<uint8_t*>(_region) + ProcessSharedSegment::DATA_OFFSET;
+};
+
+size_t ProcessSharedSegment::getDataSize() const {
+	return _size - ProcessSharedSegment::DATA_OFFSET;
+};
+
+bool ProcessSharedSegment::unlink(const std::string& name){
+	return (shm_unlink(name.c_str()) == 0);
+};
@@ -0,0 +1,115 @@
+#include <chrono>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+
+#include "shared_lock.hpp"
+
+#pragma once
+
+//Access held or awaited by one process
+struct ProcessHolder {
+	pid_t pid;
+	uint32_t readers;
+	uint32_t writers;
+	uint32_t exclusive;
+	uint32_t waiting_readers;
+	uint32_t waiting_writers;
+	uint32_t waiting_exclusive;
+};
+
+/*
+Whole state of a ProcessSharedLock, plain data meant to be placed in memory
+mapped by several processes. Mutex and condition variable are process shared,
+the mutex is robust so a process dying inside it does not block the others.
+*/
+struct ProcessSharedState {
+	static const uint32_t MAX_PROCESSES = 64;
+	uint32_t magic;
+	uint32_t policy;
+	pthread_mutex_t mutex;
+	pthread_cond_t cv;
+	int32_t readers;
+	int32_t writers;
+	int32_t exclusive;
+	int32_t waiting_readers;
+	int32_t waiting_writers;
+	int32_t waiting_exclusive;
+	uint64_t recoveries;
+	ProcessHolder holders[MAX_PROCESSES];
+};
+
+/*
+Cross process variant of SharedLock working on a ProcessSharedState.
+Same reader/writer/exclusive modes and READER, WRITER, NONE rules as
+CompactSharedLock. Access is accounted per process: holders and waiters of
+a process that died are reclaimed by the others, waits wake up every
+REAP_INTERVAL ms to look for them.
+*/
+class ProcessSharedLock {
+	public:
+	//Builds a fresh state in region, before any process attaches to it
+	static ProcessSharedState* initialize(void* region, PreferencePolicy policy);
+	ProcessSharedLock(ProcessSharedState* state);
+
+	//exclusive Access
+	void exclusiveLock();
+	bool tryExclusiveLock();
+	bool tryExclusiveLock(uint16_t timeout);
+	void exclusiveUnlock();
+
+	//read Access
+	void rSharedLock();
+	bool rTrySharedLock();
+	bool rTrySharedLock(uint16_t timeout);
+	void rSharedUnlock();
+
+	//write Access
+	void wSharedLock();
+	bool wTrySharedLock();
+	bool wTrySharedLock(uint16_t timeout);
+	void wSharedUnlock();
+
+	int32_t getNumberWriters() const;
+	int32_t getNumberReaders() const;
+	int32_t getNumberFutureReaders() const;
+	//Dead processes reclaimed so far
+	uint64_t getRecoveries() const;
+
+	static const uint32_t MAGIC;
+	static const uint16_t REAP_INTERVAL;
+	private:
+	void _lockState() const;
+	void _unlockState() const;
+	ProcessHolder* _findHolder() const;
+	ProcessHolder* _holder();
+	bool _admissible(AccessMode mode) const;
+	bool _acquire(AccessMode mode, bool timed, std::chrono::steady_clock::time_point deadline);
+	void _release(AccessMode mode);
+	bool _reap();
+	void _recount();
+	ProcessSharedState* _state;
+};
+
+/*
+POSIX shared memory segment holding a ProcessSharedState followed by
+data_size bytes of data for the processes to share.
+*/
+class ProcessSharedSegment {
+	public:
+	//Creates name (failing if it exists) and initializes the lock in it
+	ProcessSharedSegment(const std::string& name, size_t data_size, PreferencePolicy policy);
+	//Opens a segment created by another process
+	ProcessSharedSegment(const std::string& name);
+	~ProcessSharedSegment();
+	ProcessSharedState* getState() const;
+	uint8_t* getData() const;
+	size_t getDataSize() const;
+	static bool unlink(const std::string& name);
+	static const size_t DATA_OFFSET;
+	private:
+	void _map(int fd, size_t size);
+	void* _region;
+	size_t _size;
+};
@@ -0,0 +1,72 @@
+#include <iostream>
+#include <string>
+
+#include "cohort_lock.hpp"
+#include "compact_lock.hpp"
+#include "lock_backends.hpp"
+#include "lock_trace.hpp"
+#include "shared_lock.hpp"
+
+/*
+Replays a recorded lock trace against a lock implementation and policy:
+	replay <trace file> <shared|cohort|compact|pthread|std> <READER|WRITER|NONE|ADAPTIVE>
+*/
+
+static bool parse_policy(const std::string& name, PreferencePolicy& policy) {
+	if(name == "READER") policy = PreferencePolicy::READER;
+	else if(name == "WRITER") policy = PreferencePolicy::WRITER;
+	else if(name == "NONE") policy = PreferencePolicy::NONE;
+	else if(name == "ADAPTIVE") policy = PreferencePolicy::ADAPTIVE;
+	else return false;
+	return true;
+};
+
+int main(int argc, char** argv) {
+	PreferencePolicy policy;
+	if(argc != 4 or !parse_policy(argv[3], policy)) {
+		std::cerr<<"Usage: "<<argv[0]<<" <trace file> <shared|cohort|compact|pthread|std> <READER|WRITER|NONE|ADAPTIVE>"<<std::endl;
+		return 1;
+	}
+	std::vector<TraceRecord> records;
+	if(!LockTraceRecorder::load(argv[1], records)) {
+		std::cerr<<"Unable to load trace: "<<argv[1]<<std::endl;
+		return 1;
+	}
+	std::string implementation(argv[2]);
+	ReplayResult result;
+	try {
+		if(implementation == "shared") {
+			SharedLock lock(policy);
+			result = replayTrace(records, lock);
+		}
+		else if(implementation == "cohort") {
+			CohortSharedLock lock(policy);
+			result = replayTrace(records, lock);
+		}
+		else if(implementation == "compact") {
+			CompactSharedLock lock(policy);
+			result = replayTrace(records, lock);
+		}
+		else if(implementation == "pthread") {
+			RWLockSharedLock lock(policy);
+			result = replayTrace(records, lock);
+		}
+#ifdef SHARED_LOCK_STD_BACKEND
+		else if(implementation == "std") {
+			StdSharedLock lock(policy);
+			result = replayTrace(records, lock);
+		}
+#endif
+		else {
+			std::cerr<<"Unknown lock: "<<implementation<<std::endl;
+			return 1;
+		}
+	}
+	catch (std::exception& e) {
+		std::cerr<<e.what()<<std::endl;
+		return 1;
+	}
+	std::cout<<"Replaying "<<records.size()<<" operations on "<<implementation<<" "<<argv[3]<<std::endl;
+	result.print(std::cout);
+	return 0;
+};
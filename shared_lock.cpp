@@ -1,16 +1,59 @@
 #include <algorithm>
+#include <cerrno>
 #include <condition_variable>
 #include <exception>
 #include <iostream>
+#include <memory>
 #include <mutex>
+#include <stdexcept>
 
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "lock_trace.hpp"
 #include "shared_lock.hpp"
 
 using namespace std::chrono;
 
 const int32_t SharedLock::NO_LIMIT_READERS = -1;
+const uint8_t SharedLock::DEFAULT_PRIORITY = 0;
+const int SharedLock::PRIORITY_BOOST = 5;
+const uint32_t SharedLock::ADAPTIVE_WINDOW = 256;
+const uint32_t SharedLock::ADAPTIVE_MAX_WAIT_RATIO = 10;
+const uint32_t SharedLock::ACTIVITY_SLOTS = 64;
 std::mutex SharedLock::_static_lock;
 
+CancellationToken::CancellationToken(): _cancelled(false), _next_callback(0){};
+
+/*Callbacks run under _lock so unregisterCallback can wait for them*/
+void CancellationToken::cancel(){
+	std::unique_lock<std::mutex> lk(_lock);
+	_cancelled = true;
+	for(auto& callback: _callbacks) callback.second();
+};
+
+bool CancellationToken::isCancelled() const{
+	return _cancelled;
+};
+
+void CancellationToken::reset(){
+	_cancelled = false;
+};
+
+uint64_t CancellationToken::registerCallback(std::function<void()> callback){
+	std::unique_lock<std::mutex> lk(_lock);
+	_callbacks[_next_callback] = callback;
+	return _next_callback++;
+};
+
+void CancellationToken::unregisterCallback(uint64_t id){
+	std::unique_lock<std::mutex> lk(_lock);
+	_callbacks.erase(id);
+};
+
 int32_t SharedLock::_limit_readers = SharedLock::NO_LIMIT_READERS;
 
 void SharedLock::setLimitReaders(int32_t limit_readers) {
@@ -23,16 +66,24 @@ int32_t SharedLock::getLimitReaders() {
 	return SharedLock::_limit_readers;
 };
 
-SharedLock::SharedLock(PreferencePolicy policy):  _exclusive_acquired(false), _exclusive_asked(false), _future_readers(0), _locked_readers(false), _locked_writers(false), _readers(0), _turn(0), _writers(0){
+thread_local std::vector<SharedLock::ReentrantHold> SharedLock::_holds;
+thread_local uint32_t SharedLock::_activity_hint = 0;
+
+SharedLock::SharedLock(PreferencePolicy policy): SharedLock(policy, false){};
+
+SharedLock::SharedLock(PreferencePolicy policy, bool reentrant):  _activity_slots(NULL), _activity_tracking(false), _adaptive_mode(PreferencePolicy::NONE), _adaptive_switches(0), _cancel_generation(0), _closed(false), _combining(false), _exclusive_acquired(false), _future_readers(0), _locked_readers(false), _locked_writers(false), _longest_writer_wait(0), _max_writer_wait(0), _reentrant(reentrant), _priority_boost(false), _policy(policy), _published_sequence(0), _published_readers(0), _published_writers(0), _published_future_readers(0), _published_exclusive_waiters(0), _published_exclusive_holder(std::thread::id()), _published_flags(0), _read_wait(0), _readers(0), _starvation_events(0), _starving_writers(0), _trace_recorder(NULL), _turn(0), _window_reads(0), _window_writes(0), _write_wait(0), _writers(0){
+	//ADAPTIVE starts with NONE rules until traffic is observed
+	if(policy == PreferencePolicy::ADAPTIVE) policy = _adaptive_mode;
 	this->_policy_read = SharedLock::getReadPolicy(policy);
 	this->_policy_write = SharedLock::getWritePolicy(policy);
+	this->_window_start = steady_clock::now();
 };
 
 /*Abstraction for pluging in Read Policy*/
 SharedLock::f_policy SharedLock::getReadPolicy(PreferencePolicy policy){
 	switch(policy) {
 		case PreferencePolicy::XCLUSIVE: return [](SharedLock* _lock){
-			if(_lock->_exclusive_acquired || _lock->_exclusive_asked) return false;
+			if(_lock->_exclusivePending()) return false;
 			if(_lock->_locked_readers) return false;
 			if(SharedLock::getLimitReaders() != SharedLock::NO_LIMIT_READERS and _limit_readers >= _lock->_readers) return false;			
 			return ((_lock->_readers + _lock->_writers) == 0); 
@@ -41,14 +92,14 @@ SharedLock::f_policy SharedLock::getReadPolicy(PreferencePolicy policy){
 		FOR NONE all readers we can get except if one Writer
 		*/
                 case PreferencePolicy::NONE: return [](SharedLock* _lock){
-			if(_lock->_exclusive_acquired || _lock->_exclusive_asked) return false;
+			if(_lock->_exclusivePending()) return false;
 			if(_lock->_locked_readers) return false;
 			if(_lock->_writers > 0) return false;
 			if(SharedLock::getLimitReaders() != SharedLock::NO_LIMIT_READERS and _lock->_readers >= getLimitReaders()) return false;
 			return true;			 
 		}; 
 		case PreferencePolicy::ROUNDROBIN: return [](SharedLock* _lock){
-			if(_lock->_exclusive_acquired || _lock->_exclusive_asked) return false;
+			if(_lock->_exclusivePending()) return false;
 			if(_lock->_locked_readers) return false;			
 			if(SharedLock::getLimitReaders() != SharedLock::NO_LIMIT_READERS and _lock->_readers >= getLimitReaders()) return false;
 			return (((_lock->_readers + _lock->_writers) == 0) and (_lock->getActualTurn() == std::this_thread::get_id()));
@@ -57,9 +108,11 @@ SharedLock::f_policy SharedLock::getReadPolicy(PreferencePolicy policy){
 		any writers will wait until all current and future readers have finished
 		*/
 		case PreferencePolicy::READER: return [](SharedLock* _lock){
-			if(_lock->_exclusive_acquired || _lock->_exclusive_asked) return false;
+			if(_lock->_exclusivePending()) return false;
 			if(_lock->_locked_readers) return false;
 			if(SharedLock::getLimitReaders() != SharedLock::NO_LIMIT_READERS and _lock->_readers >= getLimitReaders()) return false;					
+			//A writer waited past its bound, let it in first
+			if(_lock->_starving_writers > 0) return false;
 			return true;
 		};
 
@@ -67,7 +120,7 @@ SharedLock::f_policy SharedLock::getReadPolicy(PreferencePolicy policy){
 		no additional readers will acquire until all writers have finished
 		*/
 		case PreferencePolicy::WRITER: return [](SharedLock* _lock){		
-			if(_lock->_exclusive_acquired || _lock->_exclusive_asked) return false;
+			if(_lock->_exclusivePending()) return false;
 			if(_lock->_locked_readers) return false;
 			if(SharedLock::getLimitReaders() != SharedLock::NO_LIMIT_READERS and _lock->_readers >= getLimitReaders()) return false;
 			if((_lock->_readers >= 1) and (_lock->_writers > 0)) return false;
@@ -75,7 +128,7 @@ SharedLock::f_policy SharedLock::getReadPolicy(PreferencePolicy policy){
 		};
 		/* default is freeride but clearly will never reach this point*/
 		default: return [](SharedLock* _lock){		
-			if(_lock->_exclusive_acquired || _lock->_exclusive_asked) return false;
+			if(_lock->_exclusivePending()) return false;
 			if(_lock->_locked_readers) return false;
 			return true;		
 		};
@@ -86,7 +139,7 @@ SharedLock::f_policy SharedLock::getReadPolicy(PreferencePolicy policy){
 SharedLock::f_policy SharedLock::getWritePolicy(PreferencePolicy policy){
 	switch(policy) {
 		case PreferencePolicy::XCLUSIVE: return [](SharedLock* _lock){
-			if(_lock->_exclusive_acquired || _lock->_exclusive_asked) return false;
+			if(_lock->_exclusivePending()) return false;
 			if(_lock->_locked_writers) return false;			
 			return ((_lock->_readers + _lock->_writers) == 0); 
 		}; 
@@ -94,13 +147,13 @@ SharedLock::f_policy SharedLock::getWritePolicy(PreferencePolicy policy){
 		FOR NONE Maximum 1 writer N readers
 		*/
                 case PreferencePolicy::NONE: return [](SharedLock* _lock){
-			if(_lock->_exclusive_acquired || _lock->_exclusive_asked) return false;
+			if(_lock->_exclusivePending()) return false;
 			if(_lock->_locked_writers) return false;
 			if((_lock->_writers == 0) and (_lock->_readers == 0)) return true;
 			return false;			 
 		}; 
 		case PreferencePolicy::ROUNDROBIN: return [](SharedLock* _lock){
-			if(_lock->_exclusive_acquired || _lock->_exclusive_asked) return false;
+			if(_lock->_exclusivePending()) return false;
 			if(_lock->_locked_writers) return false;
 			return (((_lock->_readers + _lock->_writers) == 0) && (_lock->getActualTurn() == std::this_thread::get_id()));
 		};
@@ -108,29 +161,251 @@ SharedLock::f_policy SharedLock::getWritePolicy(PreferencePolicy policy){
 		any writers will wait until all current and future readers have finished
 		*/		
 		case PreferencePolicy::READER: return [](SharedLock* _lock){
-			if(_lock->_exclusive_acquired || _lock->_exclusive_asked) return false;
+			if(_lock->_exclusivePending()) return false;
 			if(_lock->_locked_writers) return false;
 			if(_lock->_readers == 0  and _lock->_future_readers == 0) return true;
+			//Waiting readers are held back while a writer is starving
+			if(_lock->_readers == 0 and _lock->_starving_writers > 0) return true;
 			return false;
 		};
 	        /*If a reader already holds a shared lock, 
 		no additional readers will acquire until all writers have finished
 		*/
 		case PreferencePolicy::WRITER: return [](SharedLock* _lock){								
-			if(_lock->_exclusive_acquired || _lock->_exclusive_asked) return false;
+			if(_lock->_exclusivePending()) return false;
 			if(_lock->_locked_writers) return false;
 			//if(_lock->_readers > 1) return false;
 			return true;		
 		};
 		/* default is freeride but clearly will never reach this point*/
 		default: return [](SharedLock* _lock){		
-			if(_lock->_exclusive_acquired || _lock->_exclusive_asked) return false;
+			if(_lock->_exclusivePending()) return false;
 			if(_lock->_locked_writers) return false;
 			return true;		
 		};
 	};
 };
 
+void SharedLock::setMaxWriterWait(uint32_t max_writer_wait){
+	std::unique_lock<std::mutex> lk(_lock);
+	_max_writer_wait = max_writer_wait;
+	_cv.notify_all();
+};
+
+uint32_t SharedLock::getMaxWriterWait() const{
+	std::unique_lock<std::mutex> lk(_lock);
+	return _max_writer_wait;
+};
+
+uint64_t SharedLock::getWriterStarvationEvents() const{
+	std::unique_lock<std::mutex> lk(_lock);
+	return _starvation_events;
+};
+
+/*Longest wait of an admitted writer in ms*/
+uint64_t SharedLock::getLongestWriterWait() const{
+	std::unique_lock<std::mutex> lk(_lock);
+	return _longest_writer_wait;
+};
+
+PreferencePolicy SharedLock::getPolicy() const{
+	return _policy;
+};
+
+/*Rules in use right now, same as getPolicy unless ADAPTIVE*/
+PreferencePolicy SharedLock::getAdaptiveMode() const{
+	std::unique_lock<std::mutex> lk(_lock);
+	if(_policy != PreferencePolicy::ADAPTIVE) return _policy;
+	return _adaptive_mode;
+};
+
+uint64_t SharedLock::getPolicySwitches() const{
+	std::unique_lock<std::mutex> lk(_lock);
+	return _adaptive_switches;
+};
+
+/*
+Safe point for ADAPTIVE, called with _lock held on release. Holders keep
+their access, new rules only apply to admissions from now on.
+READER from 90% reads until it drops under 80%, WRITER from 50% reads
+until it goes over 60%, NONE in between. A mode whose other side waits
+ADAPTIVE_MAX_WAIT_RATIO times longer falls back to NONE.
+*/
+void SharedLock::_adaptPolicy(){
+	if(_policy != PreferencePolicy::ADAPTIVE) return;
+	uint32_t arrivals = _window_reads + _window_writes;
+	steady_clock::time_point now = steady_clock::now();
+	if(arrivals == 0 or (arrivals < SharedLock::ADAPTIVE_WINDOW and now - _window_start < milliseconds(100))) return;
+	uint32_t reads = (100 * _window_reads) / arrivals;
+	uint64_t read_wait = (_window_reads == 0) ? 0 : _read_wait / _window_reads;
+	uint64_t write_wait = (_window_writes == 0) ? 0 : _write_wait / _window_writes;
+	PreferencePolicy mode = PreferencePolicy::NONE;
+	if(reads >= 90 or (_adaptive_mode == PreferencePolicy::READER and reads >= 80)) mode = PreferencePolicy::READER;
+	else if(reads <= 50 or (_adaptive_mode == PreferencePolicy::WRITER and reads <= 60)) mode = PreferencePolicy::WRITER;
+	if(mode == PreferencePolicy::READER and write_wait > 1000 and write_wait > SharedLock::ADAPTIVE_MAX_WAIT_RATIO * read_wait) mode = PreferencePolicy::NONE;
+	if(mode == PreferencePolicy::WRITER and read_wait > 1000 and read_wait > SharedLock::ADAPTIVE_MAX_WAIT_RATIO * write_wait) mode = PreferencePolicy::NONE;
+	_window_reads = 0;
+	_window_writes = 0;
+	_read_wait = 0;
+	_write_wait = 0;
+	_window_start = now;
+	if(mode == _adaptive_mode) return;
+	_adaptive_mode = mode;
+	_adaptive_switches++;
+	_policy_read = SharedLock::getReadPolicy(mode);
+	_policy_write = SharedLock::getWritePolicy(mode);
+	_cv.notify_all();
+};
+
+/*
+Seqlock writer side, called with _lock held after every change of the
+published counters and before _lock is released. An odd sequence marks
+an update in progress.
+*/
+void SharedLock::_publish(){
+	uint64_t sequence = _published_sequence.load(std::memory_order_relaxed);
+	_published_sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	_published_readers.store(_readers, std::memory_order_relaxed);
+	_published_writers.store(_writers, std::memory_order_relaxed);
+	_published_future_readers.store(_future_readers, std::memory_order_relaxed);
+	_published_exclusive_waiters.store(_exclusive_queue.size(), std::memory_order_relaxed);
+	_published_exclusive_holder.store(_exclusive_holder, std::memory_order_relaxed);
+	_published_flags.store((_exclusive_acquired ? 1 : 0) | (_locked_readers ? 2 : 0) | (_locked_writers ? 4 : 0), std::memory_order_relaxed);
+	_published_sequence.store(sequence + 2, std::memory_order_release);
+};
+
+SharedLockSnapshot SharedLock::snapshot() const{
+	SharedLockSnapshot snapshot;
+	while(true) {
+		uint64_t sequence = _published_sequence.load(std::memory_order_acquire);
+		if(sequence & 1) {
+			std::this_thread::yield();
+			continue;
+		}
+		snapshot.readers = _published_readers.load(std::memory_order_relaxed);
+		snapshot.writers = _published_writers.load(std::memory_order_relaxed);
+		snapshot.future_readers = _published_future_readers.load(std::memory_order_relaxed);
+		snapshot.exclusive_waiters = _published_exclusive_waiters.load(std::memory_order_relaxed);
+		snapshot.exclusive_holder = _published_exclusive_holder.load(std::memory_order_relaxed);
+		uint8_t flags = _published_flags.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if(_published_sequence.load(std::memory_order_relaxed) != sequence) continue;
+		snapshot.exclusive_acquired = (flags & 1);
+		snapshot.locked_readers = (flags & 2);
+		snapshot.locked_writers = (flags & 4);
+		snapshot.version = sequence / 2;
+		return snapshot;
+	}
+};
+
+SharedLock::~SharedLock(){
+	delete[] _activity_slots.load();
+};
+
+//Slots are allocated once and kept, getActivity may be reading them
+void SharedLock::setActivityTracking(bool activity_tracking){
+	std::unique_lock<std::mutex> lk(_lock);
+	if(activity_tracking and _activity_slots.load() == NULL) {
+		SharedLock::ActivitySlot* slots = new SharedLock::ActivitySlot[SharedLock::ACTIVITY_SLOTS];
+		for(uint32_t index = 0; index < SharedLock::ACTIVITY_SLOTS; index++) {
+			slots[index].sequence = 0;
+			slots[index].used = false;
+			slots[index].thread = std::thread::id();
+			slots[index].mode = 0;
+			slots[index].waiting = false;
+			slots[index].since = 0;
+		}
+		_activity_slots.store(slots, std::memory_order_release);
+	}
+	if(!activity_tracking and _activity_slots.load() != NULL) {
+		for(uint32_t index = 0; index < SharedLock::ACTIVITY_SLOTS; index++) _clearActivity(index);
+	}
+	_activity_tracking = activity_tracking;
+};
+
+/*Publish what the calling thread is doing on the lock, _lock held*/
+void SharedLock::_trackActivity(AccessMode mode, bool waiting, steady_clock::time_point since){
+	if(!_activity_tracking) return;
+	SharedLock::ActivitySlot* slots = _activity_slots.load(std::memory_order_relaxed);
+	uint32_t index = _activityIndex();
+	if(index == SharedLock::ACTIVITY_SLOTS) {
+		index = 0;
+		while(index < SharedLock::ACTIVITY_SLOTS and slots[index].used.load(std::memory_order_relaxed)) index++;
+		if(index == SharedLock::ACTIVITY_SLOTS) return;
+		_activity_hint = index;
+	}
+	SharedLock::ActivitySlot& slot = slots[index];
+	uint64_t sequence = slot.sequence.load(std::memory_order_relaxed);
+	slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	slot.thread.store(std::this_thread::get_id(), std::memory_order_relaxed);
+	slot.mode.store(static_cast<uint8_t>(mode), std::memory_order_relaxed);
+	slot.waiting.store(waiting, std::memory_order_relaxed);
+	slot.since.store(since.time_since_epoch().count(), std::memory_order_relaxed);
+	slot.used.store(true, std::memory_order_relaxed);
+	slot.sequence.store(sequence + 2, std::memory_order_release);
+};
+
+void SharedLock::_untrackActivity(){
+	//Disabling tracking already cleared every slot
+	if(!_activity_tracking) return;
+	uint32_t index = _activityIndex();
+	if(index != SharedLock::ACTIVITY_SLOTS) _clearActivity(index);
+};
+
+/*
+Slot used by the calling thread, ACTIVITY_SLOTS if none. The thread local
+hint is shared by every lock, it is checked against the slot owner.
+*/
+uint32_t SharedLock::_activityIndex() const {
+	SharedLock::ActivitySlot* slots = _activity_slots.load(std::memory_order_relaxed);
+	std::thread::id thread = std::this_thread::get_id();
+	uint32_t hint = _activity_hint;
+	if(hint < SharedLock::ACTIVITY_SLOTS and slots[hint].used.load(std::memory_order_relaxed) and slots[hint].thread.load(std::memory_order_relaxed) == thread) return hint;
+	for(uint32_t index = 0; index < SharedLock::ACTIVITY_SLOTS; index++) {
+		if(slots[index].used.load(std::memory_order_relaxed) and slots[index].thread.load(std::memory_order_relaxed) == thread) return index;
+	}
+	return SharedLock::ACTIVITY_SLOTS;
+};
+
+void SharedLock::_clearActivity(uint32_t index){
+	SharedLock::ActivitySlot& slot = _activity_slots.load(std::memory_order_relaxed)[index];
+	if(!slot.used.load(std::memory_order_relaxed)) return;
+	uint64_t sequence = slot.sequence.load(std::memory_order_relaxed);
+	slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	slot.used.store(false, std::memory_order_relaxed);
+	slot.sequence.store(sequence + 2, std::memory_order_release);
+};
+
+std::vector<SharedLockActivity> SharedLock::getActivity() const{
+	std::vector<SharedLockActivity> activity;
+	SharedLock::ActivitySlot* slots = _activity_slots.load(std::memory_order_acquire);
+	if(slots == NULL) return activity;
+	for(uint32_t index = 0; index < SharedLock::ACTIVITY_SLOTS; index++) {
+		SharedLock::ActivitySlot& slot = slots[index];
+		while(true) {
+			uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+			if(sequence & 1) {
+				std::this_thread::yield();
+				continue;
+			}
+			bool used = slot.used.load(std::memory_order_relaxed);
+			SharedLockActivity entry;
+			entry.thread = slot.thread.load(std::memory_order_relaxed);
+			entry.mode = static_cast<AccessMode>(slot.mode.load(std::memory_order_relaxed));
+			entry.waiting = slot.waiting.load(std::memory_order_relaxed);
+			entry.since = steady_clock::time_point(steady_clock::duration(slot.since.load(std::memory_order_relaxed)));
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if(slot.sequence.load(std::memory_order_relaxed) != sequence) continue;
+			if(used) activity.push_back(entry);
+			break;
+		}
+	}
+	return activity;
+};
+
 int32_t SharedLock::getNumberWriters() const{
 	std::unique_lock<std::mutex> lk(_lock);
 	return _writers;
@@ -149,6 +424,7 @@ int32_t SharedLock::getNumberFutureReaders() const {
 void SharedLock::lockReaders(){
 	std::unique_lock<std::mutex> lk(_lock);
 	_locked_readers = true;
+	_publish();
 	_cv.notify_all();
 };
 
@@ -156,19 +432,21 @@ void SharedLock::lockShared(){
 	std::unique_lock<std::mutex> lk(_lock);
 	_locked_readers = true;
 	_locked_writers = true;
+	_publish();
 	_cv.notify_all();
 };
 
 void SharedLock::lockWriters(){
 	std::unique_lock<std::mutex> lk(_lock);
 	_locked_writers = true;
+	_publish();
 	_cv.notify_all();
 };
 
 void SharedLock::unlockReaders(){
 	std::unique_lock<std::mutex> lk(_lock);
 	_locked_readers = false;
-	_cv.notify_all();
+	_wakeWaiters(lk);
 };
 
 
@@ -176,13 +454,13 @@ void SharedLock::unlockShared(){
 	std::unique_lock<std::mutex> lk(_lock);
 	_locked_readers = false;
 	_locked_writers = false;
-	_cv.notify_all();
+	_wakeWaiters(lk);
 };
 
 void SharedLock::unlockWriters(){
 	std::unique_lock<std::mutex> lk(_lock);
 	_locked_writers = false;
-	_cv.notify_all();
+	_wakeWaiters(lk);
 };
 
 bool SharedLock::_checkThreadRunnable() {
@@ -192,14 +470,225 @@ bool SharedLock::_checkThreadRunnable() {
 	return true;
 };
 
+bool SharedLock::_exclusiveAvailable() const {
+	return ((!this->_exclusive_acquired) and (this->_writers == 0) and (this->_readers == 0));
+};
+
+/*Exclusive held or requested: no new readers or writers get in*/
+bool SharedLock::_exclusivePending() const {
+	return (this->_exclusive_acquired or !this->_exclusive_queue.empty());
+};
+
+/*
+Give the lock straight to the first queued exclusive request once it is
+free, waking only that thread. Must be called with _lock held.
+*/
+bool SharedLock::_handoffExclusive(){
+	if(_exclusive_queue.empty() or !_exclusiveAvailable()) return false;
+	SharedLock::ExclusiveWaiter* next = _exclusive_queue.front();
+	_exclusive_queue.pop_front();
+	_exclusive_acquired = true;
+	if(next->callback) {
+		_async_ready.push_back(next->callback);
+		delete next;
+		return true;
+	}
+	next->granted = true;
+	next->cv.notify_one();
+	return true;
+};
+
+/*Called after releasing access, unlocks lk if async callbacks are due*/
+void SharedLock::_wakeWaiters(std::unique_lock<std::mutex>& lk){
+	_admitWaiters();
+	_runAsyncReady(lk);
+};
+
+/*
+Let in whoever the current state admits, async callbacks are only queued.
+Used on release and whenever a waiter leaves without access.
+*/
+void SharedLock::_admitWaiters(){
+	_adaptPolicy();
+	if(!_handoffExclusive()) _cv.notify_all();
+	_admitAsync();
+	_publish();
+};
+
+/*Queued by priority, first come first served within the same priority*/
+void SharedLock::_queueExclusive(SharedLock::ExclusiveWaiter* waiter){
+	auto position = std::find_if(_exclusive_queue.begin(), _exclusive_queue.end(), [waiter](SharedLock::ExclusiveWaiter* queued) {return queued->priority < waiter->priority;});
+	_exclusive_queue.insert(position, waiter);
+	if(waiter->priority > SharedLock::DEFAULT_PRIORITY) _boostHolders();
+	_handoffExclusive();
+	_publish();
+};
+
+//Withdraw a request that timed out or was cancelled
+void SharedLock::_dequeueExclusive(SharedLock::ExclusiveWaiter* waiter){
+	_exclusive_queue.erase(std::find(_exclusive_queue.begin(), _exclusive_queue.end(), waiter));
+	//Readers and writers held back by our request may go now
+	_admitWaiters();
+};
+
+bool SharedLock::_waitExclusive(std::unique_lock<std::mutex>& lk, uint8_t priority, bool timed, steady_clock::time_point deadline, CancellationToken* token){
+	steady_clock::time_point arrival = steady_clock::now();
+	uint64_t generation = _cancel_generation;
+	if(_cancelled(generation, token)) return false;
+	SharedLock::ExclusiveWaiter waiter;
+	waiter.priority = priority;
+	waiter.granted = false;
+	_queueExclusive(&waiter);
+	if(!waiter.granted) _trackActivity(AccessMode::EXCLUSIVE, true, arrival);
+	while(!waiter.granted) {
+		if(_cancelled(generation, token)) {
+			_dequeueExclusive(&waiter);
+			_untrackActivity();
+			return false;
+		}
+		if(!timed) {
+			waiter.cv.wait(lk);
+			continue;
+		}
+		if(waiter.cv.wait_until(lk, deadline) == std::cv_status::timeout and !waiter.granted) {
+			_dequeueExclusive(&waiter);
+			_untrackActivity();
+			return false;
+		}
+	}
+	_threads_running.insert(std::this_thread::get_id());
+	_exclusive_holder = std::this_thread::get_id();
+	_publish();
+	_recordHolder(AccessMode::EXCLUSIVE, arrival);
+	return true;
+};
+
+bool SharedLock::_admissible(AccessMode mode) {
+	switch(mode) {
+		case AccessMode::READ: return _policy_read(this);
+		case AccessMode::WRITE: return _policy_write(this);
+		default: return _exclusiveAvailable();
+	}
+};
+
+std::multiset<uint8_t>& SharedLock::_waitingPriorities(AccessMode mode) {
+	if(mode == AccessMode::READ) return _read_priorities;
+	return _write_priorities;
+};
+
+/*
+ROUNDROBIN admission depends on the thread asking, a waiter could not tell
+whether a higher priority one would be let in. XCLUSIVE serializes everyone.
+*/
+void SharedLock::_checkPriority(uint8_t priority) const {
+	if(priority == SharedLock::DEFAULT_PRIORITY) return;
+	if(_policy == PreferencePolicy::ROUNDROBIN or _policy == PreferencePolicy::XCLUSIVE) throw std::runtime_error("Priorities not available for ROUNDROBIN and XCLUSIVE");
+};
+
+/*
+True when a waiter with more priority than ours would be let in right now
+by the policy, we step aside until it is in.
+*/
+bool SharedLock::_higherPriorityAdmissible(uint8_t priority) {
+	//Exclusive requests are ordered in their own queue and already block both
+	const AccessMode modes[] = {AccessMode::READ, AccessMode::WRITE};
+	for(auto mode: modes) {
+		std::multiset<uint8_t>& waiting = _waitingPriorities(mode);
+		if(!waiting.empty() and *waiting.rbegin() > priority and _admissible(mode)) return true;
+	}
+	return false;
+};
+
+/*
+Wait until the policy admits mode and no higher priority waiter is admissible.
+Past _max_writer_wait a writer is flagged as starving, which the READER
+policy uses to hold back new readers.
+*/
+bool SharedLock::_waitAccess(std::unique_lock<std::mutex>& lk, AccessMode mode, uint8_t priority, bool timed, steady_clock::time_point deadline, CancellationToken* token){
+	steady_clock::time_point arrival = steady_clock::now();
+	uint64_t generation = _cancel_generation;
+	bool starving = false;
+	bool ret = true;
+	bool aging = (mode == AccessMode::WRITE);
+	if(mode == AccessMode::READ) _window_reads++;
+	else _window_writes++;
+	if(priority > SharedLock::DEFAULT_PRIORITY) {
+		_waitingPriorities(mode).insert(priority);
+		_boostHolders();
+	}
+	bool tracked = false;
+	while(!_admissible(mode) or _higherPriorityAdmissible(priority) or _cancelled(generation, token)) {
+		steady_clock::time_point now = steady_clock::now();
+		if((timed and now >= deadline) or _cancelled(generation, token)) {
+			ret = false;
+			break;
+		}
+		if(!tracked) {
+			_trackActivity(mode, true, arrival);
+			tracked = true;
+		}
+		steady_clock::time_point starve_at = arrival + milliseconds(_max_writer_wait);
+		if(aging and !starving and _max_writer_wait > 0 and now >= starve_at) {
+			starving = true;
+			_starving_writers++;
+			_starvation_events++;
+			_cv.notify_all();
+			continue;
+		}
+		steady_clock::time_point wake_up = deadline;
+		if(aging and !starving and _max_writer_wait > 0) wake_up = std::min(wake_up, starve_at);
+		if(wake_up == steady_clock::time_point::max()) _cv.wait(lk);
+		else _cv.wait_until(lk, wake_up);
+	}
+	if(priority > SharedLock::DEFAULT_PRIORITY) {
+		std::multiset<uint8_t>& waiting = _waitingPriorities(mode);
+		waiting.erase(waiting.find(priority));
+		//Lower priority waiters may have stepped aside for us
+		_cv.notify_all();
+	}
+	if(starving) {
+		_starving_writers--;
+		_cv.notify_all();
+	}
+	//Async waiters held back by our request may go now, caller runs them
+	if(!ret) _admitWaiters();
+	if(ret and aging) _longest_writer_wait = std::max(_longest_writer_wait, (uint64_t) duration_cast<milliseconds>(steady_clock::now() - arrival).count());
+	if(tracked and !ret) _untrackActivity();
+	if(ret) {
+		uint64_t waited = duration_cast<microseconds>(steady_clock::now() - arrival).count();
+		if(mode == AccessMode::READ) _read_wait += waited;
+		else _write_wait += waited;
+		_recordHolder(mode, arrival);
+	}
+	return ret;
+};
+
 void SharedLock::exclusiveLock() {
+	this->exclusiveLock(SharedLock::DEFAULT_PRIORITY);
+};
+
+void SharedLock::exclusiveLock(uint8_t priority) {
+	if(!_exclusiveLock(priority, NULL)) throw LockCancelled();
+};
+
+bool SharedLock::exclusiveLock(CancellationToken& token) {
+	uint64_t callback = token.registerCallback([this] {this->_wakeCancelled();});
+	bool ret = _exclusiveLock(SharedLock::DEFAULT_PRIORITY, &token);
+	token.unregisterCallback(callback);
+	return ret;
+};
+
+bool SharedLock::_exclusiveLock(uint8_t priority, CancellationToken* token) {
+	if(_reenter(AccessMode::EXCLUSIVE)) return true;
 	std::unique_lock<std::mutex> lk(_lock);
 	if(!_checkThreadRunnable()) throw std::runtime_error("Unable to relock thread");
-	_exclusive_asked = true;
-	_cv.wait(lk, [this] {return ((!this->_exclusive_acquired) and (this->_writers == 0) and (this->_readers == 0));});
-	_exclusive_asked = false;	
-	this->_exclusive_acquired = true;
-	_threads_running.insert(std::this_thread::get_id());
+	if(!_waitExclusive(lk, priority, false, steady_clock::time_point::max(), token)) {
+		//Async waiters admitted once our request left the queue
+		_runAsyncReady(lk);
+		return false;
+	}
+	_enterHold(AccessMode::EXCLUSIVE);
+	return true;
 };
 
 bool SharedLock::tryExclusiveLock() {
@@ -207,36 +696,62 @@ bool SharedLock::tryExclusiveLock() {
 };
 
 bool SharedLock::tryExclusiveLock(uint16_t timeout) {
+	return this->tryExclusiveLock(timeout, SharedLock::DEFAULT_PRIORITY);
+};
+
+bool SharedLock::tryExclusiveLock(uint16_t timeout, uint8_t priority) {
+	if(_reenter(AccessMode::EXCLUSIVE)) return true;
 	std::unique_lock<std::mutex> lk(_lock);
-	_exclusive_asked = true;
 	if(!_checkThreadRunnable()) return false;
-	bool ret = _cv.wait_until(lk, system_clock::now() + std::chrono::milliseconds(timeout), [this] {return ((!this->_exclusive_acquired) and (this->_writers == 0) and (this->_readers == 0));});
-	if(ret) {
-		this->_exclusive_acquired = true;
-		_threads_running.insert(std::this_thread::get_id());
-	}
-	_exclusive_asked = false;
+	bool ret = _waitExclusive(lk, priority, true, steady_clock::now() + std::chrono::milliseconds(timeout), NULL);
+	if(ret) _enterHold(AccessMode::EXCLUSIVE);
+	_runAsyncReady(lk);
 	return ret;
 };
 
 void SharedLock::exclusiveUnlock() {
-	std::unique_lock<std::mutex> lk(_lock);
-	_threads_running.erase(std::this_thread::get_id());	
-	this->_exclusive_acquired = false;
-	_cv.notify_all();
+	AccessMode mode = AccessMode::EXCLUSIVE;
+	if(_leaveHold(mode)) return;
+	_releaseAccess(mode);
 };
 
 void SharedLock::rSharedLock(){
+	this->rSharedLock(SharedLock::DEFAULT_PRIORITY);
+};
+
+void SharedLock::rSharedLock(uint8_t priority){
+	if(!_rSharedLock(priority, NULL)) throw LockCancelled();
+};
+
+bool SharedLock::rSharedLock(CancellationToken& token){
+	uint64_t callback = token.registerCallback([this] {this->_wakeCancelled();});
+	bool ret = _rSharedLock(SharedLock::DEFAULT_PRIORITY, &token);
+	token.unregisterCallback(callback);
+	return ret;
+};
+
+bool SharedLock::_rSharedLock(uint8_t priority, CancellationToken* token){
+	_checkPriority(priority);
+	if(_reenter(AccessMode::READ)) return true;
 	std::unique_lock<std::mutex> lk(_lock);
 	if(!_checkThreadRunnable()) throw std::runtime_error("Unable to relock thread");
 	_future_readers++;
-	_cv.wait(lk, [this] {return _policy_read(this);});
+	_publish();
+	if(!_waitAccess(lk, AccessMode::READ, priority, false, steady_clock::time_point::max(), token)) {
+		//READER writers may be waiting for future readers to drain
+		_future_readers--;
+		_wakeWaiters(lk);
+		return false;
+	}
 	_threads_running.insert(std::this_thread::get_id());
 	_readers++;
 	_future_readers--;
+	_publish();
+	_enterHold(AccessMode::READ);
 	//std::unique_lock<std::mutex> turn_lk(_t_lock);
 	_turn++;
 	if(_turn >= _round_robin_turn.size()) _turn = 0;
+	return true;
 };
 
 bool SharedLock::rTrySharedLock() {
@@ -244,34 +759,65 @@ bool SharedLock::rTrySharedLock() {
 };
 	
 bool SharedLock::rTrySharedLock(uint16_t timeout){
+	return this->rTrySharedLock(timeout, SharedLock::DEFAULT_PRIORITY);
+};
+
+bool SharedLock::rTrySharedLock(uint16_t timeout, uint8_t priority){
+	_checkPriority(priority);
+	if(_reenter(AccessMode::READ)) return true;
 	std::unique_lock<std::mutex> lk(_lock);
 	if(!_checkThreadRunnable()) return false;	
-	bool ret = _cv.wait_until(lk, system_clock::now() + std::chrono::milliseconds(timeout), [this] {return _policy_read(this);});
+	bool ret = _waitAccess(lk, AccessMode::READ, priority, true, steady_clock::now() + std::chrono::milliseconds(timeout), NULL);
 	if(ret) {
 		_threads_running.insert(std::this_thread::get_id());
 		_readers++;
+		_publish();
+		_enterHold(AccessMode::READ);
 	}
 	//std::cout<<"Readers: " << _readers << " Writers: "<< _writers<<std::endl;
+	_runAsyncReady(lk);
 	return ret;
 };
 
 
 void SharedLock::rSharedUnlock(){
-	std::unique_lock<std::mutex> lk(_lock);
-	_readers--;
-	_threads_running.erase(std::this_thread::get_id());
-	_cv.notify_all();
+	AccessMode mode = AccessMode::READ;
+	if(_leaveHold(mode)) return;
+	_releaseAccess(mode);
 };
 
 void SharedLock::wSharedLock(){
+	this->wSharedLock(SharedLock::DEFAULT_PRIORITY);
+};
+
+void SharedLock::wSharedLock(uint8_t priority){
+	if(!_wSharedLock(priority, NULL)) throw LockCancelled();
+};
+
+bool SharedLock::wSharedLock(CancellationToken& token){
+	uint64_t callback = token.registerCallback([this] {this->_wakeCancelled();});
+	bool ret = _wSharedLock(SharedLock::DEFAULT_PRIORITY, &token);
+	token.unregisterCallback(callback);
+	return ret;
+};
+
+bool SharedLock::_wSharedLock(uint8_t priority, CancellationToken* token){
+	_checkPriority(priority);
+	if(_reenter(AccessMode::WRITE)) return true;
 	std::unique_lock<std::mutex> lk(_lock);
 	if(!_checkThreadRunnable()) throw std::runtime_error("Unable to relock thread");
-	_cv.wait(lk, [this] {return _policy_write(this);});
+	if(!_waitAccess(lk, AccessMode::WRITE, priority, false, steady_clock::time_point::max(), token)) {
+		_runAsyncReady(lk);
+		return false;
+	}
 	_threads_running.insert(std::this_thread::get_id());	
 	_writers++;
+	_publish();
+	_enterHold(AccessMode::WRITE);
 	//std::unique_lock<std::mutex> turn_lk(_t_lock);	
 	_turn++;
 	if(_turn >= _round_robin_turn.size()) _turn = 0;
+	return true;
 };
 
 bool SharedLock::wTrySharedLock() {
@@ -279,21 +825,436 @@ bool SharedLock::wTrySharedLock() {
 };
 
 bool SharedLock::wTrySharedLock(uint16_t timeout){
+	return this->wTrySharedLock(timeout, SharedLock::DEFAULT_PRIORITY);
+};
+
+bool SharedLock::wTrySharedLock(uint16_t timeout, uint8_t priority){
+	_checkPriority(priority);
+	if(_reenter(AccessMode::WRITE)) return true;
 	std::unique_lock<std::mutex> lk(_lock);
 	if(!_checkThreadRunnable()) return false;
-	bool ret = _cv.wait_until(lk, system_clock::now() + std::chrono::milliseconds(timeout), [this] {return _policy_write(this);});
+	bool ret = _waitAccess(lk, AccessMode::WRITE, priority, true, steady_clock::now() + std::chrono::milliseconds(timeout), NULL);
 	if(ret) {
 		_threads_running.insert(std::this_thread::get_id());	
 		_writers++;
+		_publish();
+		_enterHold(AccessMode::WRITE);
 	}
+	_runAsyncReady(lk);
 	return ret;
 };
 
 void SharedLock::wSharedUnlock(){
+	AccessMode mode = AccessMode::WRITE;
+	if(_leaveHold(mode)) return;
+	_releaseAccess(mode);
+};
+
+void SharedLock::_releaseAccess(AccessMode mode){
 	std::unique_lock<std::mutex> lk(_lock);
-	_writers--;
+	_releaseHolder();
+	switch(mode) {
+		case AccessMode::READ: _readers--; break;
+		case AccessMode::WRITE: _writers--; break;
+		default:
+			this->_exclusive_acquired = false;
+			_exclusive_holder = std::thread::id();
+	}
 	_threads_running.erase(std::this_thread::get_id());
+	_wakeWaiters(lk);
+};
+
+/*
+Reentrant mode: nested acquisitions only touch the thread local hold list.
+A hold covers the same or a weaker mode, READ < WRITE < EXCLUSIVE. Upgrades
+fall through to the usual path, which refuses them.
+*/
+bool SharedLock::_reenter(AccessMode mode){
+	if(!_reentrant) return false;
+	for(auto& hold: _holds) {
+		if(hold.lock != this) continue;
+		if(hold.mode < mode) return false;
+		hold.count++;
+		return true;
+	}
+	return false;
+};
+
+void SharedLock::_enterHold(AccessMode mode){
+	if(_reentrant) _holds.push_back({this, mode, 1});
+};
+
+/*
+True while nested holds remain. The outermost unlock releases the lock in
+the mode the hold was taken, whatever unlock call comes last: mode is set
+to it.
+*/
+bool SharedLock::_leaveHold(AccessMode& mode){
+	if(!_reentrant) return false;
+	for(auto hold = _holds.begin(); hold != _holds.end(); hold++) {
+		if(hold->lock != this) continue;
+		if(--hold->count > 0) return true;
+		mode = hold->mode;
+		_holds.erase(hold);
+		return false;
+	}
+	return false;
+};
+
+/*
+Cancelled when the lock was closed, cancelAll() ran since the wait started
+(generation moved) or the token of the caller was cancelled.
+*/
+bool SharedLock::_cancelled(uint64_t generation, CancellationToken* token) const {
+	if(_closed or generation != _cancel_generation) return true;
+	return (token != NULL and token->isCancelled());
+};
+
+//Waiters recheck _cancelled, the others just wait again
+void SharedLock::_wakeCancelled(){
+	std::unique_lock<std::mutex> lk(_lock);
 	_cv.notify_all();
+	for(auto waiter: _exclusive_queue) {
+		if(!waiter->callback) waiter->cv.notify_all();
+	}
+	for(auto pending: _combine_pending) pending->cv.notify_all();
+};
+
+void SharedLock::cancelAll(){
+	std::unique_lock<std::mutex> lk(_lock);
+	_cancel_generation++;
+	_cancelAsync(lk);
+	_wakeCancelled();
+};
+
+void SharedLock::close(){
+	std::unique_lock<std::mutex> lk(_lock);
+	_closed = true;
+	_cancel_generation++;
+	_cancelAsync(lk);
+	_wakeCancelled();
+};
+
+/*
+Drop every queued async request, readers and writers held back by them may
+go now. Releases _lock, then runs the cancelled callbacks.
+*/
+void SharedLock::_cancelAsync(std::unique_lock<std::mutex>& lk){
+	std::vector<SharedLock::f_callback> cancelled;
+	bool dropped = !_async_waiters.empty();
+	for(auto& waiter: _async_waiters) {
+		if(waiter.mode == AccessMode::READ) _future_readers--;
+		if(waiter.cancelled) cancelled.push_back(waiter.cancelled);
+	}
+	_async_waiters.clear();
+	for(auto it = _exclusive_queue.begin(); it != _exclusive_queue.end();) {
+		if(!(*it)->callback) {
+			it++;
+			continue;
+		}
+		if((*it)->cancelled) cancelled.push_back((*it)->cancelled);
+		delete *it;
+		it = _exclusive_queue.erase(it);
+		dropped = true;
+	}
+	if(dropped) _wakeWaiters(lk);
+	if(lk.owns_lock()) lk.unlock();
+	for(auto& callback: cancelled) callback();
+};
+
+bool SharedLock::isClosed() const{
+	std::unique_lock<std::mutex> lk(_lock);
+	return _closed;
+};
+
+void SharedLock::setPriorityBoost(bool priority_boost){
+	std::unique_lock<std::mutex> lk(_lock);
+	_priority_boost = priority_boost;
+	if(priority_boost) return;
+#ifdef __linux__
+	for(auto& boosted: _boosted) setpriority(PRIO_PROCESS, boosted.first, boosted.second);
+#endif
+	_boosted.clear();
+	_holder_tids.clear();
+};
+
+void SharedLock::setTraceRecorder(LockTraceRecorder* recorder){
+	std::unique_lock<std::mutex> lk(_lock);
+	_trace_recorder = recorder;
+	_trace_holds.clear();
+};
+
+/*Holders are only tracked while boosting or tracing is enabled*/
+void SharedLock::_recordHolder(AccessMode mode, steady_clock::time_point arrival){
+	_trackActivity(mode, false, steady_clock::now());
+	if(_trace_recorder != NULL) _trace_holds[std::this_thread::get_id()] = {mode, arrival, steady_clock::now()};
+#ifdef __linux__
+	if(!_priority_boost) return;
+	_holder_tids[std::this_thread::get_id()] = syscall(SYS_gettid);
+#endif
+};
+
+void SharedLock::_releaseHolder(){
+	_untrackActivity();
+	if(_trace_recorder != NULL) {
+		auto hold = _trace_holds.find(std::this_thread::get_id());
+		if(hold != _trace_holds.end()) {
+			_trace_recorder->record(hold->first, hold->second.mode, hold->second.arrival, hold->second.acquired, steady_clock::now());
+			_trace_holds.erase(hold);
+		}
+	}
+#ifdef __linux__
+	if(!_priority_boost) return;
+	auto holder = _holder_tids.find(std::this_thread::get_id());
+	if(holder == _holder_tids.end()) return;
+	auto boosted = _boosted.find(holder->second);
+	if(boosted != _boosted.end()) {
+		setpriority(PRIO_PROCESS, boosted->first, boosted->second);
+		_boosted.erase(boosted);
+	}
+	_holder_tids.erase(holder);
+#endif
+};
+
+/*
+Best effort: raise scheduling priority of current holders so a priority
+waiter is not stuck behind them. Needs CAP_SYS_NICE, failures are ignored.
+*/
+void SharedLock::_boostHolders(){
+#ifdef __linux__
+	if(!_priority_boost) return;
+	for(auto& holder: _holder_tids) {
+		if(_boosted.find(holder.second) != _boosted.end()) continue;
+		errno = 0;
+		int nice = getpriority(PRIO_PROCESS, holder.second);
+		if(errno != 0) continue;
+		if(setpriority(PRIO_PROCESS, holder.second, nice - SharedLock::PRIORITY_BOOST) == 0) _boosted[holder.second] = nice;
+	}
+#endif
+};
+
+void SharedLock::setExecutor(SharedLock::f_executor executor){
+	std::unique_lock<std::mutex> lk(_lock);
+	_executor = executor;
+};
+
+void SharedLock::asyncExclusiveLock(SharedLock::f_callback callback){
+	this->_asyncLock(AccessMode::EXCLUSIVE, callback, SharedLock::f_callback());
+};
+
+void SharedLock::asyncExclusiveLock(SharedLock::f_callback callback, SharedLock::f_callback cancelled){
+	this->_asyncLock(AccessMode::EXCLUSIVE, callback, cancelled);
+};
+
+void SharedLock::asyncRSharedLock(SharedLock::f_callback callback){
+	this->_asyncLock(AccessMode::READ, callback, SharedLock::f_callback());
+};
+
+void SharedLock::asyncRSharedLock(SharedLock::f_callback callback, SharedLock::f_callback cancelled){
+	this->_asyncLock(AccessMode::READ, callback, cancelled);
+};
+
+void SharedLock::asyncWSharedLock(SharedLock::f_callback callback){
+	this->_asyncLock(AccessMode::WRITE, callback, SharedLock::f_callback());
+};
+
+void SharedLock::asyncWSharedLock(SharedLock::f_callback callback, SharedLock::f_callback cancelled){
+	this->_asyncLock(AccessMode::WRITE, callback, cancelled);
+};
+
+std::future<void> SharedLock::exclusiveLockFuture(){
+	std::shared_ptr<std::promise<void>> promise = std::make_shared<std::promise<void>>();
+	std::future<void> future = promise->get_future();
+	this->_asyncLock(AccessMode::EXCLUSIVE, [promise] {promise->set_value();}, [promise] {promise->set_exception(std::make_exception_ptr(LockCancelled()));});
+	return future;
+};
+
+std::future<void> SharedLock::rSharedLockFuture(){
+	std::shared_ptr<std::promise<void>> promise = std::make_shared<std::promise<void>>();
+	std::future<void> future = promise->get_future();
+	this->_asyncLock(AccessMode::READ, [promise] {promise->set_value();}, [promise] {promise->set_exception(std::make_exception_ptr(LockCancelled()));});
+	return future;
+};
+
+std::future<void> SharedLock::wSharedLockFuture(){
+	std::shared_ptr<std::promise<void>> promise = std::make_shared<std::promise<void>>();
+	std::future<void> future = promise->get_future();
+	this->_asyncLock(AccessMode::WRITE, [promise] {promise->set_value();}, [promise] {promise->set_exception(std::make_exception_ptr(LockCancelled()));});
+	return future;
+};
+
+void SharedLock::_asyncLock(AccessMode mode, SharedLock::f_callback callback, SharedLock::f_callback cancelled){
+	std::unique_lock<std::mutex> lk(_lock);
+	if(_policy == PreferencePolicy::ROUNDROBIN) throw std::runtime_error("Async lock not available for ROUNDROBIN");
+	if(_closed) throw LockCancelled();
+	//Async readers wait as future readers, same as blocked ones
+	if(mode == AccessMode::EXCLUSIVE) {
+		SharedLock::ExclusiveWaiter* waiter = new SharedLock::ExclusiveWaiter();
+		waiter->priority = SharedLock::DEFAULT_PRIORITY;
+		waiter->granted = false;
+		waiter->callback = callback;
+		waiter->cancelled = cancelled;
+		_queueExclusive(waiter);
+		_runAsyncReady(lk);
+		return;
+	}
+	if(mode == AccessMode::READ) {
+		_future_readers++;
+		_window_reads++;
+	}
+	else _window_writes++;
+	_async_waiters.push_back({mode, callback, cancelled});
+	_admitAsync();
+	_publish();
+	_runAsyncReady(lk);
+};
+
+/*
+Grant every queued async reader/writer the policy lets in, oldest first.
+Async exclusive requests go through the exclusive queue.
+Must be called with _lock held, callbacks are run later by _runAsyncReady
+*/
+void SharedLock::_admitAsync(){
+	for(auto it = _async_waiters.begin(); it != _async_waiters.end();) {
+		bool admitted = false;
+		switch(it->mode) {
+			case AccessMode::READ:
+				if(_policy_read(this)) {
+					_readers++;
+					_future_readers--;
+					admitted = true;
+				}
+				break;
+			case AccessMode::WRITE:
+				if(_policy_write(this)) {
+					_writers++;
+					admitted = true;
+				}
+				break;
+			default:
+				break;
+		}
+		if(!admitted) {
+			it++;
+			continue;
+		}
+		_async_ready.push_back(it->callback);
+		it = _async_waiters.erase(it);
+	}
+};
+
+/*
+Releases _lock before running callbacks, they may lock again. Every granted
+callback runs even when one of them or the executor throws, the first
+exception is rethrown afterwards.
+*/
+void SharedLock::_runAsyncReady(std::unique_lock<std::mutex>& lk){
+	if(_async_ready.empty()) return;
+	std::vector<SharedLock::f_callback> ready;
+	ready.swap(_async_ready);
+	SharedLock::f_executor executor = _executor;
+	lk.unlock();
+	std::exception_ptr error;
+	for(auto& callback: ready) {
+		try {
+			if(executor) executor(callback);
+			else callback();
+		}
+		catch (...) {
+			if(!error) error = std::current_exception();
+		}
+	}
+	if(error) std::rethrow_exception(error);
+};
+
+/*
+Flat combining: callers publish their operation and wait on their own slot.
+The first caller finding nobody combining takes write access and runs every
+pending operation in batches until the queue is empty.
+*/
+void SharedLock::combineWrite(std::function<void()> operation){
+	if(!_combineWrite(operation, NULL)) throw LockCancelled();
+};
+
+bool SharedLock::combineWrite(std::function<void()> operation, CancellationToken& token){
+	uint64_t callback = token.registerCallback([this] {this->_wakeCancelled();});
+	bool ret = _combineWrite(operation, &token);
+	token.unregisterCallback(callback);
+	return ret;
+};
+
+bool SharedLock::_combineWrite(std::function<void()> operation, CancellationToken* token){
+	SharedLock::CombineRecord record;
+	record.operation = operation;
+	record.done = false;
+	std::unique_lock<std::mutex> lk(_lock);
+	if(!_checkThreadRunnable()) throw std::runtime_error("Unable to relock thread");
+	uint64_t generation = _cancel_generation;
+	if(_cancelled(generation, token)) return false;
+	_combine_pending.push_back(&record);
+	record.cv.wait(lk, [this, &record, generation, token] {return record.done or !this->_combining or this->_cancelled(generation, token);});
+	if(!record.done and _cancelled(generation, token)) {
+		auto pending = std::find(_combine_pending.begin(), _combine_pending.end(), &record);
+		if(pending != _combine_pending.end()) {
+			_combine_pending.erase(pending);
+			return false;
+		}
+		//Already taken in a batch, the combiner still uses our record
+		record.cv.wait(lk, [&record] {return record.done;});
+	}
+	if(!record.done) {
+		_combining = true;
+		lk.unlock();
+		bool acquired;
+		try {
+			acquired = this->_wSharedLock(SharedLock::DEFAULT_PRIORITY, token);
+		}
+		catch (...) {
+			//Write access refused: fail every pending operation, ours included
+			lk.lock();
+			_combining = false;
+			for(auto pending: _combine_pending) {
+				pending->error = std::current_exception();
+				pending->done = true;
+				pending->cv.notify_one();
+			}
+			_combine_pending.clear();
+			lk.unlock();
+			throw;
+		}
+		lk.lock();
+		if(!acquired) {
+			//Cancelled: leave, the next pending caller takes over combining
+			_combining = false;
+			_combine_pending.erase(std::find(_combine_pending.begin(), _combine_pending.end(), &record));
+			for(auto pending: _combine_pending) pending->cv.notify_one();
+			return false;
+		}
+		while(!_combine_pending.empty()) {
+			std::vector<SharedLock::CombineRecord*> batch;
+			batch.swap(_combine_pending);
+			lk.unlock();
+			for(auto pending: batch) {
+				try {
+					pending->operation();
+				}
+				catch (...) {
+					pending->error = std::current_exception();
+				}
+			}
+			lk.lock();
+			for(auto pending: batch) {
+				pending->done = true;
+				pending->cv.notify_one();
+			}
+		}
+		_combining = false;
+		lk.unlock();
+		this->wSharedUnlock();
+		lk.lock();
+	}
+	if(record.error) std::rethrow_exception(record.error);
+	return true;
 };
 
 void SharedLock::notify(){
@@ -1,45 +1,260 @@
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <deque>
+#include <exception>
 #include <functional>
+#include <future>
 #include <mutex>
+#include <map>
 #include <set>
+#include <stdexcept>
 #include <stdint.h>
+#include <sys/types.h>
 #include <thread>
 #include <vector>
 
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+#include <coroutine>
+#define SHARED_LOCK_COROUTINES
+#endif
+
 #pragma once
 
+class LockTraceRecorder;
+
 enum class PreferencePolicy {
 	XCLUSIVE, // ONLY ONE THREAD, THREAD IS SELECTED ONE BY ONE RANDOMLY
 	ROUNDROBIN, // ONLY ONE THREAD, THREAD ARE SELECTED IN ROUND ROBIN
 	READER,
 	WRITER,
 	NONE,
+	ADAPTIVE, // SWITCHES BETWEEN READER, WRITER AND NONE FROM OBSERVED TRAFFIC
 };
 
+enum class AccessMode {
+	READ,
+	WRITE,
+	EXCLUSIVE,
+};
 
-class SharedLock {
+
+//Result of a blocking acquisition cancelled by cancelAll() or close()
+class LockCancelled: public std::runtime_error {
+	public:
+	LockCancelled(): std::runtime_error("Lock acquisition cancelled"){};
+};
+
+/*
+Cancels the lock waits it is passed to. Locks waiting on it register a
+callback waking them, run by cancel() from the cancelling thread.
+*/
+class CancellationToken {
+	public:
+	CancellationToken();
+	void cancel();
+	bool isCancelled() const;
+	//Back to not cancelled, once no wait uses it anymore
+	void reset();
+	uint64_t registerCallback(std::function<void()> callback);
+	//Returns once the callback is not running anymore
+	void unregisterCallback(uint64_t id);
+	private:
+	std::map<uint64_t, std::function<void()>> _callbacks;
+	std::atomic<bool> _cancelled;
+	std::mutex _lock;
+	uint64_t _next_callback;
+};
+
+//Lock state as seen at one instant, see SharedLock::snapshot
+struct SharedLockSnapshot {
+	int32_t readers;
+	int32_t writers;
+	int32_t future_readers;
+	uint32_t exclusive_waiters;
+	bool exclusive_acquired;
+	//Default id when free or held through asyncExclusiveLock
+	std::thread::id exclusive_holder;
+	bool locked_readers;
+	bool locked_writers;
+	//Bumped on every published change
+	uint64_t version;
+};
+
+//A thread waiting for or holding a SharedLock, see SharedLock::getActivity
+struct SharedLockActivity {
+	std::thread::id thread;
+	AccessMode mode;
+	bool waiting;
+	//Start of the wait, or of the hold once granted
+	std::chrono::steady_clock::time_point since;
+};
+
+/*
+Access calls shared by SharedLock and the lock backends (lock_backends.hpp),
+clients such as Reader, Writer and WorkloadDriver only use these so they run
+against whichever lock they are given.
+*/
+class SharedLockInterface {
+	public:
+	virtual ~SharedLockInterface(){};
+	virtual void exclusiveLock() = 0;
+	virtual bool exclusiveLock(CancellationToken& token) = 0;
+	virtual bool tryExclusiveLock() = 0;
+	virtual bool tryExclusiveLock(uint16_t timeout) = 0;
+	virtual void exclusiveUnlock() = 0;
+	virtual void rSharedLock() = 0;
+	virtual bool rSharedLock(CancellationToken& token) = 0;
+	virtual bool rTrySharedLock() = 0;
+	virtual bool rTrySharedLock(uint16_t timeout) = 0;
+	virtual void rSharedUnlock() = 0;
+	virtual void wSharedLock() = 0;
+	virtual bool wSharedLock(CancellationToken& token) = 0;
+	virtual bool wTrySharedLock() = 0;
+	virtual bool wTrySharedLock(uint16_t timeout) = 0;
+	virtual void wSharedUnlock() = 0;
+	virtual bool combineWrite(std::function<void()> operation, CancellationToken& token) = 0;
+	virtual int32_t getNumberWriters() const = 0;
+	virtual int32_t getNumberReaders() const = 0;
+	virtual int32_t getNumberFutureReaders() const = 0;
+	virtual void registerThread() = 0;
+	virtual void unregisterThread() = 0;
+};
+
+class SharedLock: public SharedLockInterface {
 	public:
 	SharedLock(PreferencePolicy policy);
-	~SharedLock(){};
+	/*
+	Reentrant: a thread holding access takes it again (same or weaker mode)
+	with a thread local count, only the outermost unlock releases the lock.
+	Shared access is never upgraded, that still throws.
+	*/
+	SharedLock(PreferencePolicy policy, bool reentrant);
+	~SharedLock();
 	
 	//exclusive Access
 	void exclusiveLock();
+	void exclusiveLock(uint8_t priority);
 	bool tryExclusiveLock();
 	bool tryExclusiveLock(uint16_t timeout);
+	bool tryExclusiveLock(uint16_t timeout, uint8_t priority);
 	void exclusiveUnlock();
 	
+	/*
+	Cancellable waits: false once token is cancelled, or on cancelAll() or
+	close(). The other blocking calls throw LockCancelled in that case.
+	*/
+	bool exclusiveLock(CancellationToken& token);
+	bool rSharedLock(CancellationToken& token);
+	bool wSharedLock(CancellationToken& token);
+	//Wakes every current waiter with a cancelled result, holders keep their access
+	void cancelAll();
+	//cancelAll and refuse every later acquisition, for shutdown
+	void close();
+	bool isClosed() const;
+
 	//read Access	
 	void rSharedLock();
+	void rSharedLock(uint8_t priority);
 	bool rTrySharedLock();
 	bool rTrySharedLock(uint16_t timeout);
+	bool rTrySharedLock(uint16_t timeout, uint8_t priority);
 	void rSharedUnlock();
 	
 	//write Access	
 	void wSharedLock();
+	void wSharedLock(uint8_t priority);
 	bool wTrySharedLock();
 	bool wTrySharedLock(uint16_t timeout);
+	bool wTrySharedLock(uint16_t timeout, uint8_t priority);
 	void wSharedUnlock();
 
+	/*
+	Priorities: among waiters the policy would let in, higher priority goes
+	first. With boosting, holders get a higher scheduling priority while a
+	priority waiter is queued behind them.
+	Read and write priorities are refused with ROUNDROBIN and XCLUSIVE, their
+	admission is decided by turn or serialization, not among waiters.
+	*/
+	static const uint8_t DEFAULT_PRIORITY;
+	void setPriorityBoost(bool priority_boost);
+
+	/*
+	Asynchronous access: callback runs once access is granted, on the releasing
+	thread or through the executor. Holder is not bound to a thread, release it
+	with the usual unlock call from a thread not holding this lock itself.
+	Not available with ROUNDROBIN, turns are given to registered threads.
+	Requests still queued by close() or cancelAll() are dropped, their cancelled
+	callback runs instead and futures throw LockCancelled.
+	*/
+	typedef std::function<void()> f_callback;
+	typedef std::function<void(f_callback)> f_executor;
+	void setExecutor(f_executor executor);
+	void asyncExclusiveLock(f_callback callback);
+	void asyncRSharedLock(f_callback callback);
+	void asyncWSharedLock(f_callback callback);
+	void asyncExclusiveLock(f_callback callback, f_callback cancelled);
+	void asyncRSharedLock(f_callback callback, f_callback cancelled);
+	void asyncWSharedLock(f_callback callback, f_callback cancelled);
+	std::future<void> exclusiveLockFuture();
+	std::future<void> rSharedLockFuture();
+	std::future<void> wSharedLockFuture();
+#ifdef SHARED_LOCK_COROUTINES
+	//co_await lock.rSharedLockAwait(); resumes holding access
+	struct LockAwaiter {
+		SharedLock* lock;
+		AccessMode mode;
+		bool cancelled = false;
+		bool await_ready() const noexcept {return false;};
+		void await_suspend(std::coroutine_handle<> handle) {lock->_asyncLock(mode, [handle] {handle.resume();}, [this, handle] {cancelled = true; handle.resume();});};
+		void await_resume() const {if(cancelled) throw LockCancelled();};
+	};
+	LockAwaiter exclusiveLockAwait() {return LockAwaiter{this, AccessMode::EXCLUSIVE};};
+	LockAwaiter rSharedLockAwait() {return LockAwaiter{this, AccessMode::READ};};
+	LockAwaiter wSharedLockAwait() {return LockAwaiter{this, AccessMode::WRITE};};
+#endif
+
+	//Flat combining: publish operation, whoever holds write access runs every pending one
+	void combineWrite(std::function<void()> operation);
+	//False, operation not run, when cancelled before a combiner picked it up
+	bool combineWrite(std::function<void()> operation, CancellationToken& token);
+
+	/*
+	READER policy aging: a writer waiting longer than max_writer_wait ms
+	holds back new readers until it gets in. 0 disables it.
+	*/
+	void setMaxWriterWait(uint32_t max_writer_wait);
+	uint32_t getMaxWriterWait() const;
+	uint64_t getWriterStarvationEvents() const;
+	uint64_t getLongestWriterWait() const;
+
+	/*
+	ADAPTIVE: read/write mix and wait times of the last window decide whether
+	READER, WRITER or NONE rules apply. Switches happen on release, with
+	hysteresis so a mix near a threshold does not flip every window.
+	*/
+	PreferencePolicy getPolicy() const;
+	PreferencePolicy getAdaptiveMode() const;
+	uint64_t getPolicySwitches() const;
+
+	//Every granted acquisition is reported to recorder on release, NULL stops tracing
+	void setTraceRecorder(LockTraceRecorder* recorder);
+
+	/*
+	Consistent view of the counters without taking _lock: every change is
+	published under a sequence counter and readers retry on a torn read.
+	*/
+	SharedLockSnapshot snapshot() const;
+
+	/*
+	Activity tracking: waiters and holders publish themselves in per thread
+	slots that getActivity reads without taking _lock. Async holds and
+	threads beyond ACTIVITY_SLOTS are not tracked.
+	*/
+	void setActivityTracking(bool activity_tracking);
+	std::vector<SharedLockActivity> getActivity() const;
+	static const uint32_t ACTIVITY_SLOTS;
+
 	int32_t getNumberWriters() const;
 	int32_t getNumberReaders() const;
 	int32_t getNumberFutureReaders() const;
@@ -67,26 +282,152 @@ class SharedLock {
 	//Also for Round Robin
 	std::thread::id getActualTurn();
 	bool _checkThreadRunnable();
+	bool _exclusiveAvailable() const;
+	bool _exclusivePending() const;
+	bool _handoffExclusive();
+	void _wakeWaiters(std::unique_lock<std::mutex>& lk);
+	void _admitWaiters();
+	bool _admissible(AccessMode mode);
+	std::multiset<uint8_t>& _waitingPriorities(AccessMode mode);
+	bool _higherPriorityAdmissible(uint8_t priority);
+	void _checkPriority(uint8_t priority) const;
+	bool _waitAccess(std::unique_lock<std::mutex>& lk, AccessMode mode, uint8_t priority, bool timed, std::chrono::steady_clock::time_point deadline, CancellationToken* token);
+	bool _cancelled(uint64_t generation, CancellationToken* token) const;
+	bool _combineWrite(std::function<void()> operation, CancellationToken* token);
+	void _wakeCancelled();
+	bool _exclusiveLock(uint8_t priority, CancellationToken* token);
+	bool _rSharedLock(uint8_t priority, CancellationToken* token);
+	bool _wSharedLock(uint8_t priority, CancellationToken* token);
+	void _adaptPolicy();
+	void _recordHolder(AccessMode mode, std::chrono::steady_clock::time_point arrival);
+	void _releaseHolder();
+	void _boostHolders();
+	void _asyncLock(AccessMode mode, f_callback callback, f_callback cancelled);
+	void _cancelAsync(std::unique_lock<std::mutex>& lk);
+	void _admitAsync();
+	void _runAsyncReady(std::unique_lock<std::mutex>& lk);
+	void _publish();
+	void _trackActivity(AccessMode mode, bool waiting, std::chrono::steady_clock::time_point since);
+	void _untrackActivity();
+	uint32_t _activityIndex() const;
+	void _clearActivity(uint32_t index);
+	bool _reenter(AccessMode mode);
+	void _enterHold(AccessMode mode);
+	bool _leaveHold(AccessMode& mode);
+	void _releaseAccess(AccessMode mode);
+
+	//Exclusive request, sync ones wait on cv, async ones carry the callback
+	struct ExclusiveWaiter {
+		std::condition_variable cv;
+		bool granted;
+		uint8_t priority;
+		f_callback callback;
+		f_callback cancelled;
+	};
+	void _queueExclusive(ExclusiveWaiter* waiter);
+	void _dequeueExclusive(ExclusiveWaiter* waiter);
+	bool _waitExclusive(std::unique_lock<std::mutex>& lk, uint8_t priority, bool timed, std::chrono::steady_clock::time_point deadline, CancellationToken* token);
+
+	//Seqlock protected, written under _lock, read by getActivity
+	struct ActivitySlot {
+		std::atomic<uint64_t> sequence;
+		std::atomic<bool> used;
+		std::atomic<std::thread::id> thread;
+		std::atomic<uint8_t> mode;
+		std::atomic<bool> waiting;
+		std::atomic<int64_t> since;
+	};
+
+	//Access held by the current thread on a reentrant lock
+	struct ReentrantHold {
+		const SharedLock* lock;
+		AccessMode mode;
+		uint32_t count;
+	};
+	static thread_local std::vector<SharedLock::ReentrantHold> _holds;
+	//Activity slot last used by this thread, on any lock
+	static thread_local uint32_t _activity_hint;
+
+	struct TraceHold {
+		AccessMode mode;
+		std::chrono::steady_clock::time_point arrival;
+		std::chrono::steady_clock::time_point acquired;
+	};
+
+	struct AsyncWaiter {
+		AccessMode mode;
+		f_callback callback;
+		f_callback cancelled;
+	};
+
+	//Slot published by a combineWrite caller, lives on its stack
+	struct CombineRecord {
+		std::function<void()> operation;
+		std::condition_variable cv;
+		bool done;
+		std::exception_ptr error;
+	};
 
 	typedef std::function<bool(SharedLock*)> f_policy;
 	static SharedLock::f_policy getReadPolicy(PreferencePolicy policy);
 	static SharedLock::f_policy getWritePolicy(PreferencePolicy policy);
 	static std::mutex _static_lock;
 	static int32_t _limit_readers;
+	static const int PRIORITY_BOOST;
+	static const uint32_t ADAPTIVE_WINDOW;
+	static const uint32_t ADAPTIVE_MAX_WAIT_RATIO;
+	std::atomic<SharedLock::ActivitySlot*> _activity_slots;
+	bool _activity_tracking;
+	PreferencePolicy _adaptive_mode;
+	uint64_t _adaptive_switches;
+	std::vector<f_callback> _async_ready;
+	std::map<pid_t, int> _boosted;
+	std::deque<SharedLock::AsyncWaiter> _async_waiters;
+	uint64_t _cancel_generation;
+	bool _closed;
+	std::vector<SharedLock::CombineRecord*> _combine_pending;
+	bool _combining;
 	std::condition_variable _cv;
 	bool _exclusive_acquired;
-	bool _exclusive_asked;
+	std::thread::id _exclusive_holder;
+	std::deque<SharedLock::ExclusiveWaiter*> _exclusive_queue;
+	f_executor _executor;
 	int32_t _future_readers;
+	std::map<std::thread::id, pid_t> _holder_tids;
 	bool _locked_readers;
 	bool _locked_writers;
 	mutable std::mutex _lock;
+	uint64_t _longest_writer_wait;
+	uint32_t _max_writer_wait;
+	const bool _reentrant;
+	bool _priority_boost;
+	PreferencePolicy _policy;
 	SharedLock::f_policy _policy_read;
 	SharedLock::f_policy _policy_write;
+	//Mirror of the counters for snapshot(), written by _publish only
+	std::atomic<uint64_t> _published_sequence;
+	std::atomic<int32_t> _published_readers;
+	std::atomic<int32_t> _published_writers;
+	std::atomic<int32_t> _published_future_readers;
+	std::atomic<uint32_t> _published_exclusive_waiters;
+	std::atomic<std::thread::id> _published_exclusive_holder;
+	std::atomic<uint8_t> _published_flags;
 	std::mutex _t_lock;
 	std::vector<std::thread::id> _round_robin_turn;
 	//We save actual threads ID to avoid thread lock reuse which cause deadlock
 	std::set<std::thread::id> _threads_running;
+	std::multiset<uint8_t> _read_priorities;
+	uint64_t _read_wait;
 	int32_t _readers;
+	uint64_t _starvation_events;
+	int32_t _starving_writers;
+	std::map<std::thread::id, SharedLock::TraceHold> _trace_holds;
+	LockTraceRecorder* _trace_recorder;
 	int32_t _turn;
+	uint32_t _window_reads;
+	std::chrono::steady_clock::time_point _window_start;
+	uint32_t _window_writes;
+	std::multiset<uint8_t> _write_priorities;
+	uint64_t _write_wait;
 	int32_t _writers;
 };
@@ -1,17 +1,51 @@
+#include <algorithm>
 #include <cstddef>
+#include <exception>
 #include <functional>
 #include <iostream>
+#include <new>
+#include <stdexcept>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <thread>
 #include <unistd.h>
 #include "test_objects.hpp"
 #include "shared_lock.hpp"
 
-uint32_t MemorySpace::DEFAULT_SIZE = 1024*1024*1024; //1M
+const size_t MemorySpace::SEGMENT_SIZE = 64*1024; //64K
+const size_t MemorySpace::NO_LIMIT = 0;
 
 static MemorySpace* _memory_space = NULL;
 
+/*
+Segments released by restartMemory or a destroyed MemorySpace are kept for
+the next ones, up to SEGMENT_POOL_MAX.
+*/
+static const size_t SEGMENT_POOL_MAX = 256;
+static std::mutex segment_pool_lock;
+static std::vector<uint8_t*> segment_pool;
+
+static uint8_t* allocate_segment() {
+	{
+		std::unique_lock<std::mutex> lk(segment_pool_lock);
+		if(!segment_pool.empty()) {
+			uint8_t* segment = segment_pool.back();
+			segment_pool.pop_back();
+			return segment;
+		}
+	}
+	void* segment = NULL;
+	if(posix_memalign(&segment, 64, MemorySpace::SEGMENT_SIZE) != 0) throw std::bad_alloc();
+	return static_cast<uint8_t*>(segment);
+};
+
+static void release_segment(uint8_t* segment) {
+	std::unique_lock<std::mutex> lk(segment_pool_lock);
+	if(segment_pool.size() < SEGMENT_POOL_MAX) segment_pool.push_back(segment);
+	else free(segment);
+};
+
 uint32_t MemorySpace::_RSLEEP = 1*1000; // 1 ms
 uint32_t MemorySpace::_WSLEEP = 5*1000; //5 ms
 
@@ -19,21 +53,25 @@ MemorySpace* get_memory_space() {
 	if(_memory_space == NULL) _memory_space = new MemorySpace();
 	return _memory_space; 	
 };
-MemorySpace::MemorySpace(): _max_size(DEFAULT_SIZE), _rw_position(0){
-	_memory_space = new uint8_t[DEFAULT_SIZE];
-};
+MemoryView::MemoryView(): data(NULL), offset(0), size(0){};
+
+MemoryView::MemoryView(const uint8_t* data, size_t offset, size_t size): data(data), offset(offset), size(size){};
+
+MemorySpace::MemorySpace(): _max_size(MemorySpace::NO_LIMIT), _next_cursor(0), _rw_position(0), _wake_generation(0){};
+
+MemorySpace::MemorySpace(size_t size): _max_size(size), _next_cursor(0), _rw_position(0), _wake_generation(0){};
 
-MemorySpace::MemorySpace(uint32_t size): _max_size(size), _rw_position(0) {
-	_memory_space = new uint8_t[size];
+MemorySpace::~MemorySpace(){
+	for(auto segment: _segments) release_segment(segment);
 };
 
 std::ostream& operator<<(std::ostream& os, const MemorySpace& memory) {
 	std::unique_lock<std::mutex> lk(memory._mutex);	
 	os<<"Memory Space: "<<memory._rw_position<<std::endl;
-	for(uint32_t index = 0; index < memory._rw_position;) {
+	for(size_t index = 0; index < memory._rw_position;) {
 		os<<"index: "<< std::dec<<index;		
-		for(uint32_t index_2 = 0; index_2 < 10; index_2++) {
-			os<< std::hex<<" 0x"<<memory._memory_space[index + index_2];
+		for(size_t index_2 = index; index_2 < std::min(index + 10, memory._rw_position); index_2++) {
+			os<< std::hex<<" 0x"<<memory._segments[index_2 / MemorySpace::SEGMENT_SIZE][index_2 % MemorySpace::SEGMENT_SIZE];
 		}
 		os<<std::endl;
 		index += 10;
@@ -44,9 +82,11 @@ std::ostream& operator<<(std::ostream& os, const MemorySpace& memory) {
 
 void MemorySpace::restartMemory(){
 	std::unique_lock<std::mutex> lk(_mutex);
-	delete[] _memory_space;
+	for(auto segment: _segments) release_segment(segment);
+	_segments.clear();
 	this->_rw_position = 0;
-	_memory_space = new uint8_t[_max_size];
+	for(auto& cursor: _cursors) cursor.second = 0;
+	_data_cv.notify_all();
 };
 
 size_t MemorySpace::getSize() const {
@@ -54,11 +94,87 @@ size_t MemorySpace::getSize() const {
 	return this->_rw_position;
 };
 
+size_t MemorySpace::getNumberSegments() const {
+	std::unique_lock<std::mutex> lk(_mutex);
+	return _segments.size();
+};
+
+//From offset to the end of written data or of its segment, _mutex held
+MemoryView MemorySpace::_segmentView(size_t offset) const {
+	if(offset >= _rw_position) return MemoryView(NULL, offset, 0);
+	size_t in_segment = offset % MemorySpace::SEGMENT_SIZE;
+	size_t size = std::min(_rw_position - offset, MemorySpace::SEGMENT_SIZE - in_segment);
+	return MemoryView(_segments[offset / MemorySpace::SEGMENT_SIZE] + in_segment, offset, size);
+};
+
+MemoryView MemorySpace::view() const {
+	return this->view(0);
+};
+
+MemoryView MemorySpace::view(size_t offset) const {
+	std::unique_lock<std::mutex> lk(_mutex);
+	//Written bytes are never moved by write, only restartMemory frees them
+	return _segmentView(offset);
+};
+
+uint32_t MemorySpace::openCursor() {
+	std::unique_lock<std::mutex> lk(_mutex);
+	uint32_t cursor = _next_cursor++;
+	_cursors[cursor] = 0;
+	return cursor;
+};
+
+void MemorySpace::closeCursor(uint32_t cursor) {
+	std::unique_lock<std::mutex> lk(_mutex);
+	_cursors.erase(cursor);
+};
+
+MemoryView MemorySpace::readNew(uint32_t cursor) {
+	std::unique_lock<std::mutex> lk(_mutex);
+	auto it = _cursors.find(cursor);
+	if(it == _cursors.end()) throw std::runtime_error("Unknown cursor");
+	MemoryView view = _segmentView(it->second);
+	it->second = view.offset + view.size;
+	return view;
+};
+
+/*Lowest position still pending for any cursor, data below it has been read by everyone*/
+size_t MemorySpace::getLowWatermark() const {
+	std::unique_lock<std::mutex> lk(_mutex);
+	size_t watermark = _rw_position;
+	for(auto& cursor: _cursors) watermark = std::min(watermark, cursor.second);
+	return watermark;
+};
+
+bool MemorySpace::waitForData(size_t position, uint16_t timeout) {
+	return this->waitForData(position, timeout, this->getWakeGeneration());
+};
+
+bool MemorySpace::waitForData(size_t position, uint16_t timeout, uint64_t generation) {
+	std::unique_lock<std::mutex> lk(_mutex);
+	return _data_cv.wait_for(lk, std::chrono::milliseconds(timeout), [this, position, generation] {return this->_rw_position > position or this->_wake_generation != generation;});
+};
+
+uint64_t MemorySpace::getWakeGeneration() const {
+	std::unique_lock<std::mutex> lk(_mutex);
+	return _wake_generation;
+};
+
+void MemorySpace::wakeReaders() {
+	std::unique_lock<std::mutex> lk(_mutex);
+	_wake_generation++;
+	_data_cv.notify_all();
+};
+
 size_t MemorySpace::read(uint8_t* buffer, size_t size) {
 		{
 		std::unique_lock<std::mutex> lk(_mutex);
-		if(!((_rw_position - size) < 0)) return 0;
-		memcpy(buffer, _memory_space + _rw_position - size, size);
+		if(size > _rw_position) return 0;
+		for(size_t copied = 0; copied < size;) {
+			MemoryView view = _segmentView(_rw_position - size + copied);
+			memcpy(buffer + copied, view.data, view.size);
+			copied += view.size;
+		}
 		//_rw_position -= size;
 	}
 	//Simulate X time on non shared resource
@@ -68,18 +184,209 @@ size_t MemorySpace::read(uint8_t* buffer, size_t size) {
 
 size_t MemorySpace::write(uint8_t* buffer, size_t size) {
 	//std::cout<<"position: "<< _rw_position<<" size: "<< _max_size<<std::endl;	
+	size_t written = 0;
 		{
 		std::unique_lock<std::mutex> lk(_mutex);
-		if(!((_rw_position + size) > this->_max_size)) {
-			memcpy(_memory_space + _rw_position, buffer, size);
-			_rw_position += size;
+		if(this->_max_size == MemorySpace::NO_LIMIT or !((_rw_position + size) > this->_max_size)) {
+			//Spills into new segments, the filled ones are left in place
+			while(written < size) {
+				size_t in_segment = _rw_position % MemorySpace::SEGMENT_SIZE;
+				if(in_segment == 0 and _rw_position / MemorySpace::SEGMENT_SIZE == _segments.size()) _segments.push_back(allocate_segment());
+				size_t chunk = std::min(size - written, MemorySpace::SEGMENT_SIZE - in_segment);
+				memcpy(_segments.back() + in_segment, buffer + written, chunk);
+				written += chunk;
+				_rw_position += chunk;
+			}
+			_data_cv.notify_all();
 			}
 		}
 	//Simulate X time on non shared resource
 	usleep(MemorySpace::_WSLEEP);
+	return written;
+};
+
+
+/*
+SHARDED MEMORY SPACE
+*/
+ShardedMemorySpace::ShardedMemorySpace(uint32_t num_shards, PreferencePolicy policy): _next_cursor(0), _scan_cursors(NULL), _scan_generation(0), _scan_pending(0), _scan_running(false), _scan_sizes(NULL), _scan_stop(false), _scan_visitor(NULL){
+	if(num_shards == 0) throw std::runtime_error("Sharded memory space needs one shard");
+	for(uint32_t shard = 0; shard < num_shards; shard++) {
+		_shards.push_back(new MemorySpace());
+		_locks.push_back(new SharedLock(policy));
+	}
+};
+
+ShardedMemorySpace::~ShardedMemorySpace(){
+	{
+		std::unique_lock<std::mutex> lk(_scan_mutex);
+		_scan_stop = true;
+		_scan_cv.notify_all();
+	}
+	std::for_each(_scan_workers.begin(), _scan_workers.end(), [](std::thread& t){t.join();});
+	for(auto shard: _shards) delete shard;
+	for(auto lock: _locks) delete lock;
+};
+
+uint32_t ShardedMemorySpace::getNumberShards() const {
+	return _shards.size();
+};
+
+//Fibonacci hashing, consecutive keys land on different shards
+uint32_t ShardedMemorySpace::getShard(uint64_t key) const {
+	return ((key * 0x9E3779B97F4A7C15ull) >> 32) % _shards.size();
+};
+
+uint32_t ShardedMemorySpace::getThreadShard() const {
+	return this->getShard(std::hash<std::thread::id>()(std::this_thread::get_id()));
+};
+
+MemorySpace* ShardedMemorySpace::getMemorySpace(uint32_t shard) const {
+	return _shards.at(shard);
+};
+
+SharedLock* ShardedMemorySpace::getLock(uint32_t shard) const {
+	return _locks.at(shard);
+};
+
+size_t ShardedMemorySpace::write(uint64_t key, uint8_t* buffer, size_t size){
+	uint32_t shard = this->getShard(key);
+	_locks[shard]->wSharedLock();
+	size_t written = _shards[shard]->write(buffer, size);
+	_locks[shard]->wSharedUnlock();
+	return written;
+};
+
+size_t ShardedMemorySpace::write(uint8_t* buffer, size_t size){
+	uint32_t shard = this->getThreadShard();
+	_locks[shard]->wSharedLock();
+	size_t written = _shards[shard]->write(buffer, size);
+	_locks[shard]->wSharedUnlock();
+	return written;
+};
+
+uint32_t ShardedMemorySpace::openCursor(){
+	std::unique_lock<std::mutex> lk(_mutex);
+	uint32_t cursor = _next_cursor++;
+	for(auto shard: _shards) _cursors[cursor].push_back(shard->openCursor());
+	return cursor;
+};
+
+void ShardedMemorySpace::closeCursor(uint32_t cursor){
+	std::unique_lock<std::mutex> lk(_mutex);
+	auto it = _cursors.find(cursor);
+	if(it == _cursors.end()) return;
+	for(uint32_t shard = 0; shard < _shards.size(); shard++) _shards[shard]->closeCursor(it->second[shard]);
+	_cursors.erase(it);
+};
+
+size_t ShardedMemorySpace::_scanShard(uint32_t shard, uint32_t shard_cursor, f_visitor& visitor){
+	size_t size = 0;
+	_locks[shard]->rSharedLock();
+	try {
+		for(MemoryView view = _shards[shard]->readNew(shard_cursor); view.size > 0; view = _shards[shard]->readNew(shard_cursor)) {
+			visitor(shard, view);
+			size += view.size;
+		}
+	}
+	catch (...) {
+		_locks[shard]->rSharedUnlock();
+		throw;
+	}
+	_locks[shard]->rSharedUnlock();
+	return size;
+};
+
+size_t ShardedMemorySpace::scan(uint32_t cursor, f_visitor visitor, bool parallel){
+	std::vector<uint32_t> shard_cursors;
+	{
+		std::unique_lock<std::mutex> lk(_mutex);
+		auto it = _cursors.find(cursor);
+		if(it == _cursors.end()) throw std::runtime_error("Unknown cursor");
+		shard_cursors = it->second;
+	}
+	std::vector<size_t> sizes(_shards.size(), 0);
+	if(!parallel) {
+		for(uint32_t shard = 0; shard < _shards.size(); shard++) sizes[shard] = _scanShard(shard, shard_cursors[shard], visitor);
+	}
+	else {
+		std::unique_lock<std::mutex> lk(_scan_mutex);
+		_scan_done_cv.wait(lk, [this] {return !this->_scan_running;});
+		_scan_running = true;
+		if(_scan_workers.empty()) {
+			for(uint32_t shard = 1; shard < _shards.size(); shard++) _scan_workers.push_back(std::thread(&ShardedMemorySpace::_scanWorker, this, shard, _scan_generation));
+		}
+		_scan_cursors = &shard_cursors;
+		_scan_sizes = &sizes;
+		_scan_visitor = &visitor;
+		_scan_error = std::exception_ptr();
+		_scan_pending = _shards.size() - 1;
+		_scan_generation++;
+		_scan_cv.notify_all();
+		lk.unlock();
+		//Shard 0 is ours, no hand over
+		std::exception_ptr error;
+		try {
+			sizes[0] = _scanShard(0, shard_cursors[0], visitor);
+		}
+		catch (...) {
+			error = std::current_exception();
+		}
+		//Workers use our stack until they are done, even when we failed
+		lk.lock();
+		_scan_done_cv.wait(lk, [this] {return this->_scan_pending == 0;});
+		if(!error) error = _scan_error;
+		_scan_error = std::exception_ptr();
+		_scan_running = false;
+		_scan_done_cv.notify_all();
+		lk.unlock();
+		if(error) std::rethrow_exception(error);
+	}
+	size_t size = 0;
+	for(auto shard_size: sizes) size += shard_size;
+	return size;
+};
+
+void ShardedMemorySpace::_scanWorker(uint32_t shard, uint64_t generation){
+	std::unique_lock<std::mutex> lk(_scan_mutex);
+	while(true) {
+		_scan_cv.wait(lk, [this, generation] {return this->_scan_stop or this->_scan_generation != generation;});
+		if(_scan_stop) return;
+		generation = _scan_generation;
+		lk.unlock();
+		size_t size = 0;
+		std::exception_ptr error;
+		try {
+			size = _scanShard(shard, (*_scan_cursors)[shard], *_scan_visitor);
+		}
+		catch (...) {
+			error = std::current_exception();
+		}
+		lk.lock();
+		//First error of the scan, rethrown by scan() on the calling thread
+		if(error and !_scan_error) _scan_error = error;
+		(*_scan_sizes)[shard] = size;
+		if(--_scan_pending == 0) _scan_done_cv.notify_all();
+	}
+};
+
+size_t ShardedMemorySpace::getSize() const {
+	size_t size = 0;
+	for(auto shard: _shards) size += shard->getSize();
 	return size;
 };
 
+const size_t DataGenerator::MAX_DATA_SIZE = 15;
+
+size_t DataGenerator::getData(uint8_t* buffer, size_t capacity){
+	size_t size = 0;
+	while(capacity - size >= DataGenerator::MAX_DATA_SIZE) {
+		size_t generated = this->getData(buffer + size);
+		if(generated == 0) break;
+		size += generated;
+	}
+	return size;
+};
 
 CharDataGenerator::CharDataGenerator(uint8_t value): _value(value){};
 
@@ -88,6 +395,11 @@ size_t CharDataGenerator::getData(uint8_t* data){
 	return 1;
 };
 
+size_t CharDataGenerator::getData(uint8_t* buffer, size_t capacity){
+	memset(buffer, _value, capacity);
+	return capacity;
+};
+
 /*
 */
 
@@ -117,9 +429,9 @@ bool RWOut::status(){
 /*
 READER
 */
-uint32_t Reader::_SLEEP = 1*1000;
+uint16_t Reader::_WAIT_TIMEOUT = 100; // 100 ms
 
-Reader::Reader(SharedLock* shared_lock): _lock(shared_lock){
+Reader::Reader(SharedLockInterface* shared_lock): _bytes_read(0), _lock(shared_lock){
 	_memory_space = get_memory_space();
 };
 
@@ -130,25 +442,37 @@ void Reader::readContinously() {
 void Reader::stop() {
 	if (_thread == NULL and !_thread->joinable()) return;
 	_out.set();
+	_cancel.cancel();
+	_memory_space->wakeReaders();
 	_thread->join();
 	_out.reset();
+	_cancel.reset();
 	delete _thread;
 };
 
 void Reader::continousRead(){
 	_lock->registerThread();
+	_cursor = _memory_space->openCursor();
+	//Read before checking _out, a stop() in between still ends the wait
+	uint64_t generation = _memory_space->getWakeGeneration();
 	while(!_out.status()) {
-		_lock->rSharedLock();
-		size_t size = _memory_space->getSize();
-		uint8_t* buffer = new uint8_t[size];		
-		_memory_space->read(buffer, size);
+		if(!_lock->rSharedLock(_cancel)) break;
+		//Data is processed in place while the shared lock pins it
+		MemoryView view = _memory_space->readNew(_cursor);
+		_bytes_read += view.size;
 		_lock->rSharedUnlock();
-		usleep(Reader::_SLEEP);
-		delete buffer;
+		//Sleep until a writer appends past what we already consumed
+		_memory_space->waitForData(view.offset + view.size, Reader::_WAIT_TIMEOUT, generation);
+		generation = _memory_space->getWakeGeneration();
 	}
+	_memory_space->closeCursor(_cursor);
 	_lock->unregisterThread();
 };
 
+uint64_t Reader::getBytesRead() const {
+	return _bytes_read;
+};
+
 size_t Reader::punctualRead(uint8_t* buffer, size_t size){
 	_lock->rSharedLock();
 	size_t ret = _memory_space->read(buffer, size);
@@ -161,8 +485,9 @@ WRITER
 */
 uint32_t Writer::_SLEEP = 1*1000;
 
-Writer::Writer(SharedLock* shared_lock): _lock(shared_lock){
+Writer::Writer(SharedLockInterface* shared_lock): _batch_size(1), _lock(shared_lock), _max_latency(0){
 	_data_generator = new CharDataGenerator('a');
+	_flat_combining = false;
 	_memory_space = get_memory_space();
 	_thread = NULL;
 };
@@ -173,11 +498,22 @@ void Writer::setDataGenerator(DataGenerator* data_generator){
 	_data_generator = data_generator;
 };
 
+void Writer::setBatching(size_t batch_size, uint16_t max_latency){
+	_batch_size = batch_size;
+	_max_latency = max_latency;
+};
+
+void Writer::setFlatCombining(bool flat_combining){
+	_flat_combining = flat_combining;
+};
+
 void Writer::stop(){
 	if (_thread == NULL and !_thread->joinable()) return;
 	_out.set();
+	_cancel.cancel();
 	_thread->join();
 	_out.reset();
+	_cancel.reset();
 	delete _thread;
 };
 
@@ -187,16 +523,48 @@ void Writer::writeContinously() {
 
 
 
+void Writer::commit(uint8_t* buffer, size_t size){
+	if(_flat_combining) {
+		MemorySpace* memory_space = _memory_space;
+		_lock->combineWrite([memory_space, buffer, size] {memory_space->write(buffer, size);}, _cancel);
+		return;
+	}
+	if(!_lock->wSharedLock(_cancel)) return;
+	_memory_space->write(buffer, size);
+	_lock->wSharedUnlock();
+};
+
+/*
+Gather generator output locally until batch size or max latency is reached
+*/
+size_t Writer::fillBatch(uint8_t* buffer){
+	size_t size = 0;
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(_max_latency);
+	while(!_out.status()) {
+		//Ask for what is missing, at least one full output
+		size += _data_generator->getData(buffer + size, std::max(_batch_size - size, DataGenerator::MAX_DATA_SIZE));
+		if(size >= _batch_size || std::chrono::steady_clock::now() >= deadline) break;
+		usleep(Writer::_SLEEP);
+	}
+	return size;
+};
+
 void Writer::continousWrite(){
-	uint8_t* buffer = new uint8_t[15];
+	//Room for a whole batch plus one generator output overflowing it
+	size_t capacity = _batch_size + DataGenerator::MAX_DATA_SIZE;
+	uint8_t* buffer = new uint8_t[capacity];
 	_lock->registerThread();	
 	while(!_out.status()) {
-		size_t size = _data_generator->getData(buffer);
-		//std::cout<<"Writing: "<< buffer<<std::endl;
-		_lock->wSharedLock();
-		_memory_space->write(buffer, size);
-		_lock->wSharedUnlock();
-		usleep(Writer::_SLEEP);
+		if(_batch_size <= 1) {
+			size_t size = _data_generator->getData(buffer);
+			//std::cout<<"Writing: "<< buffer<<std::endl;
+			commit(buffer, size);
+			usleep(Writer::_SLEEP);
+			continue;
+		}
+		size_t size = fillBatch(buffer);
+		if(size == 0) continue;
+		commit(buffer, size);
 	}
 	_lock->unregisterThread();	
 	delete[] buffer;
@@ -1,35 +1,137 @@
 
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <map>
 #include <thread>
 #include <mutex>
+#include <vector>
+
+#include "shared_lock.hpp"
 
 #pragma once
 
-class SharedLock;
+/*
+Read only window over MemorySpace data, nothing is copied.
+Valid while the owner keeps its shared lock, restartMemory invalidates it.
+Never crosses a segment, the rest starts at offset + size.
+*/
+struct MemoryView {
+	MemoryView();
+	MemoryView(const uint8_t* data, size_t offset, size_t size);
+	const uint8_t* data;
+	size_t offset;
+	size_t size;
+};
 
+/*
+Append only space made of SEGMENT_SIZE chunks, cache line aligned and taken
+from a pool as it grows. Written bytes never move. Unbounded unless built
+with a size, writes that do not fit it are dropped and return 0.
+*/
 class MemorySpace {
 	public:
 	MemorySpace();
-	MemorySpace(uint32_t size);	
+	MemorySpace(size_t size);
+	~MemorySpace();
 	size_t read(uint8_t* buffer, size_t size);
 	size_t write(uint8_t* buffer, size_t size);
+	MemoryView view() const;
+	MemoryView view(size_t offset) const;
+	//Per reader cursors, only data appended since last readNew is returned
+	uint32_t openCursor();
+	void closeCursor(uint32_t cursor);
+	MemoryView readNew(uint32_t cursor);
+	size_t getLowWatermark() const;
+	//Blocks until size grows past position, woken by write
+	bool waitForData(size_t position, uint16_t timeout);
+	//Also returns once wakeReaders ran since generation was read
+	bool waitForData(size_t position, uint16_t timeout, uint64_t generation);
+	uint64_t getWakeGeneration() const;
+	void wakeReaders();
 	size_t getSize() const;
+	size_t getNumberSegments() const;
 	void restartMemory();
+	static const size_t SEGMENT_SIZE;
+	static const size_t NO_LIMIT;
 	friend std::ostream& operator<<(std::ostream& os, const MemorySpace& person);
 	private:
-	static uint32_t DEFAULT_SIZE;
 	static uint32_t _RSLEEP;
 	static uint32_t _WSLEEP;
-	uint32_t _max_size;
-	uint8_t* _memory_space;
+	MemoryView _segmentView(size_t offset) const;
+	std::map<uint32_t, size_t> _cursors;
+	std::condition_variable _data_cv;
+	size_t _max_size;
 	mutable std::mutex _mutex;
-	uint32_t _rw_position;
+	uint32_t _next_cursor;
+	size_t _rw_position;
+	std::vector<uint8_t*> _segments;
+	uint64_t _wake_generation;
 };
 
 MemorySpace* get_memory_space();
 
+/*
+Data split over num_shards MemorySpace, each guarded by its own SharedLock so
+unrelated writers and readers do not contend. Writers go to the shard of a
+key, or of the calling thread. A cursor holds one position per shard.
+*/
+class ShardedMemorySpace {
+	public:
+	//Called with each new view while its shard is read locked
+	typedef std::function<void(uint32_t shard, const MemoryView& view)> f_visitor;
+	ShardedMemorySpace(uint32_t num_shards, PreferencePolicy policy);
+	~ShardedMemorySpace();
+	uint32_t getNumberShards() const;
+	uint32_t getShard(uint64_t key) const;
+	uint32_t getThreadShard() const;
+	MemorySpace* getMemorySpace(uint32_t shard) const;
+	SharedLock* getLock(uint32_t shard) const;
+	size_t write(uint64_t key, uint8_t* buffer, size_t size);
+	size_t write(uint8_t* buffer, size_t size);
+	uint32_t openCursor();
+	void closeCursor(uint32_t cursor);
+	/*
+	Visits what every shard got since the last scan of cursor and returns the
+	bytes visited. Parallel scans hand every shard but the first to a worker
+	of its own, started by the first parallel scan and kept until destruction.
+	Visitor calls of different shards then overlap, parallel scans run one at
+	a time. The first exception of a visitor is rethrown once every shard is
+	done.
+	*/
+	size_t scan(uint32_t cursor, f_visitor visitor, bool parallel);
+	size_t getSize() const;
+	private:
+	size_t _scanShard(uint32_t shard, uint32_t shard_cursor, f_visitor& visitor);
+	void _scanWorker(uint32_t shard, uint64_t generation);
+	std::map<uint32_t, std::vector<uint32_t>> _cursors;
+	std::vector<SharedLock*> _locks;
+	mutable std::mutex _mutex;
+	uint32_t _next_cursor;
+	//Parallel scan in progress, workers pick it up when _scan_generation moves
+	std::condition_variable _scan_cv;
+	std::vector<uint32_t>* _scan_cursors;
+	std::condition_variable _scan_done_cv;
+	std::exception_ptr _scan_error;
+	uint64_t _scan_generation;
+	std::mutex _scan_mutex;
+	uint32_t _scan_pending;
+	bool _scan_running;
+	std::vector<size_t>* _scan_sizes;
+	bool _scan_stop;
+	f_visitor* _scan_visitor;
+	std::vector<std::thread> _scan_workers;
+	std::vector<MemorySpace*> _shards;
+};
+
 class DataGenerator {
 	public:
+	//Biggest output of a single getData(data) call
+	static const size_t MAX_DATA_SIZE;
 	virtual size_t getData(uint8_t* data) = 0;
+	//Bulk variant: drains as many outputs as fit in capacity
+	virtual size_t getData(uint8_t* buffer, size_t capacity);
 	virtual ~DataGenerator(){};
 };
 
@@ -37,6 +139,7 @@ class CharDataGenerator: public DataGenerator {
 	public:
 	CharDataGenerator(uint8_t value);
 	size_t getData(uint8_t* data);
+	size_t getData(uint8_t* buffer, size_t capacity);
 	private:
 	uint8_t _value;
 };
@@ -59,14 +162,19 @@ class RWOut {
 
 class Reader {
 	public:
-	Reader(SharedLock* shared_lock);
+	Reader(SharedLockInterface* shared_lock);
 	void readContinously();
 	size_t punctualRead(uint8_t* buffer, size_t lenght);
+	uint64_t getBytesRead() const;
 	void stop();
 	private:
-	static uint32_t _SLEEP;
+	static uint16_t _WAIT_TIMEOUT;
+	std::atomic<uint64_t> _bytes_read;
+	//Cancelled by stop() so a blocked acquisition does not hold it up
+	CancellationToken _cancel;
+	uint32_t _cursor;
 	MemorySpace* _memory_space;
-	SharedLock* _lock;
+	SharedLockInterface* _lock;
 	RWOut _out;
 	std::thread* _thread;
 	uint32_t _thread_uid;
@@ -78,17 +186,27 @@ Test class to Write Access
 */
 class Writer {
 	public:
-	Writer(SharedLock* shared_lock);
+	Writer(SharedLockInterface* shared_lock);
 	void setDataGenerator(DataGenerator* data_generator);
+	//Commit up to batch_size bytes per lock acquisition, flushing after max_latency ms
+	void setBatching(size_t batch_size, uint16_t max_latency);
+	//Commit through combineWrite of the lock instead of taking write access
+	void setFlatCombining(bool flat_combining);
 	void stop();
 	void writeContinously();
 	private:
 	static uint32_t _SLEEP;
+	size_t _batch_size;
+	CancellationToken _cancel;
 	DataGenerator* _data_generator;
+	bool _flat_combining;
 	MemorySpace* _memory_space;
-	SharedLock* _lock;
+	SharedLockInterface* _lock;
+	uint16_t _max_latency;
 	RWOut _out;
 	std::thread* _thread;
 	uint32_t _thread_uid;
+	void commit(uint8_t* buffer, size_t size);
+	size_t fillBatch(uint8_t* buffer);
 	void continousWrite();
 };
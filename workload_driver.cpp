@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <chrono>
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+
+#include "test_objects.hpp"
+#include "workload_driver.hpp"
+
+using namespace std::chrono;
+
+uint32_t WorkloadDriver::_IDLE_SLEEP = 1000; // 1 ms max
+
+WorkloadDriver::WorkloadDriver(uint32_t num_workers, bool pin_workers): _read_operations(0), _read_wait(0), _next_worker(0), _pin_workers(pin_workers), _running(false), _write_operations(0), _write_wait(0) {
+	_memory_space = get_memory_space();
+	for(uint32_t index = 0; index < num_workers; index++) _workers.push_back(new WorkloadDriver::Worker());
+};
+
+WorkloadDriver::~WorkloadDriver(){
+	this->stop();
+	for(auto task: _tasks) {
+		if(task->mode == AccessMode::READ) _memory_space->closeCursor(task->cursor);
+		delete task->data_generator;
+		delete task;
+	}
+	for(auto worker: _workers) delete worker;
+};
+
+void WorkloadDriver::addReaders(SharedLockInterface* shared_lock, uint32_t n, uint32_t rate, uint32_t think_time){
+	this->addTasks(AccessMode::READ, shared_lock, n, rate, think_time);
+};
+
+void WorkloadDriver::addWriters(SharedLockInterface* shared_lock, uint32_t n, uint32_t rate, uint32_t think_time){
+	this->addTasks(AccessMode::WRITE, shared_lock, n, rate, think_time);
+};
+
+/*Tasks are spread round robin, must be added before start*/
+void WorkloadDriver::addTasks(AccessMode mode, SharedLockInterface* shared_lock, uint32_t n, uint32_t rate, uint32_t think_time){
+	for(uint32_t index = 0; index < n; index++) {
+		WorkloadDriver::Task* task = new WorkloadDriver::Task();
+		task->mode = mode;
+		task->lock = shared_lock;
+		task->interval = (rate == 0) ? clock::duration::zero() : clock::duration(duration_cast<clock::duration>(seconds(1)) / rate);
+		task->think_time = duration_cast<clock::duration>(microseconds(think_time));
+		task->next_run = clock::now();
+		task->cursor = (mode == AccessMode::READ) ? _memory_space->openCursor() : 0;
+		task->data_generator = (mode == AccessMode::WRITE) ? new CharDataGenerator('a') : NULL;
+		_tasks.push_back(task);
+		_workers[_next_worker]->queue.push(task);
+		_next_worker = (_next_worker + 1) % _workers.size();
+	}
+};
+
+void WorkloadDriver::start(){
+	if(_running.exchange(true)) return;
+	uint32_t cores = std::max(1u, std::thread::hardware_concurrency());
+	for(uint32_t index = 0; index < _workers.size(); index++) {
+		_workers[index]->thread = std::thread(&WorkloadDriver::run, this, index);
+#ifdef __linux__
+		if(!_pin_workers) continue;
+		cpu_set_t cpu_set;
+		CPU_ZERO(&cpu_set);
+		CPU_SET(index % cores, &cpu_set);
+		pthread_setaffinity_np(_workers[index]->thread.native_handle(), sizeof(cpu_set_t), &cpu_set);
+#endif
+	}
+};
+
+void WorkloadDriver::stop(){
+	if(!_running.exchange(false)) return;
+	for(auto worker: _workers) worker->thread.join();
+};
+
+uint64_t WorkloadDriver::getReadOperations() const {
+	return _read_operations;
+};
+
+uint64_t WorkloadDriver::getWriteOperations() const {
+	return _write_operations;
+};
+
+uint64_t WorkloadDriver::getAverageReadWait() const {
+	uint64_t operations = _read_operations;
+	return (operations == 0) ? 0 : _read_wait / operations;
+};
+
+uint64_t WorkloadDriver::getAverageWriteWait() const {
+	uint64_t operations = _write_operations;
+	return (operations == 0) ? 0 : _write_wait / operations;
+};
+
+/*Own queue first, otherwise steal the first due task of another worker*/
+WorkloadDriver::Task* WorkloadDriver::popDue(uint32_t worker, clock::time_point now){
+	for(uint32_t index = 0; index < _workers.size(); index++) {
+		WorkloadDriver::Worker* victim = _workers[(worker + index) % _workers.size()];
+		std::unique_lock<std::mutex> lk(victim->lock);
+		if(victim->queue.empty() or victim->queue.top()->next_run > now) continue;
+		WorkloadDriver::Task* task = victim->queue.top();
+		victim->queue.pop();
+		return task;
+	}
+	return NULL;
+};
+
+void WorkloadDriver::run(uint32_t worker){
+	WorkloadDriver::Worker* own = _workers[worker];
+	while(_running) {
+		clock::time_point now = clock::now();
+		WorkloadDriver::Task* task = this->popDue(worker, now);
+		if(task == NULL) {
+			//Nothing due anywhere, sleep until our next task or the idle cap
+			clock::time_point wake_up = now + microseconds(_IDLE_SLEEP);
+			{
+				std::unique_lock<std::mutex> lk(own->lock);
+				if(!own->queue.empty()) wake_up = std::min(wake_up, own->queue.top()->next_run);
+			}
+			std::this_thread::sleep_until(wake_up);
+			continue;
+		}
+		clock::time_point started = clock::now();
+		this->runTask(task);
+		task->next_run = std::max(clock::now() + task->think_time, started + task->interval);
+		std::unique_lock<std::mutex> lk(own->lock);
+		own->queue.push(task);
+	}
+};
+
+void WorkloadDriver::runTask(WorkloadDriver::Task* task){
+	uint8_t buffer[DataGenerator::MAX_DATA_SIZE];
+	clock::time_point arrival = clock::now();
+	if(task->mode == AccessMode::READ) {
+		task->lock->rSharedLock();
+		_read_wait += duration_cast<microseconds>(clock::now() - arrival).count();
+		_memory_space->readNew(task->cursor);
+		task->lock->rSharedUnlock();
+		_read_operations++;
+		return;
+	}
+	size_t size = task->data_generator->getData(buffer);
+	task->lock->wSharedLock();
+	_write_wait += duration_cast<microseconds>(clock::now() - arrival).count();
+	_memory_space->write(buffer, size);
+	task->lock->wSharedUnlock();
+	_write_operations++;
+};
@@ -0,0 +1,73 @@
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <queue>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include "shared_lock.hpp"
+
+#pragma once
+
+class DataGenerator;
+class MemorySpace;
+
+/*
+Runs logical readers and writers as tasks over a fixed pool of worker threads
+instead of one std::thread per client. Each worker keeps its own queue ordered
+by next run time, idle workers steal due tasks from the others.
+*/
+class WorkloadDriver {
+	public:
+	WorkloadDriver(uint32_t num_workers, bool pin_workers);
+	~WorkloadDriver();
+	//rate: operations per second of each client (0 no limit), think_time: us idle after each operation
+	void addReaders(SharedLockInterface* shared_lock, uint32_t n, uint32_t rate, uint32_t think_time);
+	void addWriters(SharedLockInterface* shared_lock, uint32_t n, uint32_t rate, uint32_t think_time);
+	void start();
+	void stop();
+	uint64_t getReadOperations() const;
+	uint64_t getWriteOperations() const;
+	//Average time waiting for the lock in us
+	uint64_t getAverageReadWait() const;
+	uint64_t getAverageWriteWait() const;
+	private:
+	static uint32_t _IDLE_SLEEP;
+	typedef std::chrono::steady_clock clock;
+
+	struct Task {
+		AccessMode mode;
+		SharedLockInterface* lock;
+		clock::duration interval;
+		clock::duration think_time;
+		clock::time_point next_run;
+		uint32_t cursor;
+		DataGenerator* data_generator;
+	};
+
+	struct TaskLater {
+		bool operator()(const Task* a, const Task* b) const {return a->next_run > b->next_run;};
+	};
+
+	struct Worker {
+		std::mutex lock;
+		std::priority_queue<Task*, std::vector<Task*>, TaskLater> queue;
+		std::thread thread;
+	};
+
+	void addTasks(AccessMode mode, SharedLockInterface* shared_lock, uint32_t n, uint32_t rate, uint32_t think_time);
+	Task* popDue(uint32_t worker, clock::time_point now);
+	void run(uint32_t worker);
+	void runTask(Task* task);
+	std::atomic<uint64_t> _read_operations;
+	std::atomic<uint64_t> _read_wait;
+	MemorySpace* _memory_space;
+	uint32_t _next_worker;
+	bool _pin_workers;
+	std::atomic<bool> _running;
+	std::vector<Task*> _tasks;
+	std::vector<Worker*> _workers;
+	std::atomic<uint64_t> _write_operations;
+	std::atomic<uint64_t> _write_wait;
+};